@@ -37,6 +37,16 @@ private:
     Vector                     m_grad;   // New gradient
     Vector                     m_gradp;  // Old gradient
     Vector                     m_drt;    // Moving direction
+    Scalar                     m_projgnorm;  // Infinity norm of the projected gradient
+    int                        m_iterations; // Iterations completed, also when an exception is thrown
+    Vector                     m_xcp;    // Generalized Cauchy point
+    Vector                     m_vecc;   // c vector of the Cauchy point
+    Vector                     m_vecs;   // s vector of the correction
+    Vector                     m_vecy;   // y vector of the correction
+    IndexSet                   m_newact_set;  // Variables that become active at the Cauchy point
+    IndexSet                   m_fv_set;      // Free variables at the Cauchy point
+    Cauchy<Scalar>             m_cauchy;      // Workspace of the Cauchy point computation
+    SubspaceMin<Scalar>        m_subspace;    // Workspace of the subspace minimization
 
     // Reset internal variables
     // n: dimension of the vector to be optimized
@@ -48,6 +58,11 @@ private:
         m_grad.resize(n);
         m_gradp.resize(n);
         m_drt.resize(n);
+        m_xcp.resize(n);
+        m_vecs.resize(n);
+        m_vecy.resize(n);
+        m_newact_set.reserve(n);
+        m_fv_set.reserve(n);
         if(m_param.past > 0)
             m_fx.resize(m_param.past);
     }
@@ -92,7 +107,7 @@ public:
     ///        algorithm
     ///
     LBFGSBSolver(const LBFGSBParam<Scalar>& param) :
-        m_param(param)
+        m_param(param), m_projgnorm(0), m_iterations(0)
     {
         m_param.check_param();
     }
@@ -128,13 +143,15 @@ public:
 
         // Initialization
         reset(n);
+        m_iterations = 0;
 
         // The length of lag for objective function value to test convergence
         const int fpast = m_param.past;
 
         // Evaluate function and compute gradient
         fx = f(x, m_grad);
-        Scalar projgnorm = proj_grad_norm(x, m_grad, lb, ub);
+        Scalar& projgnorm = m_projgnorm;
+        projgnorm = proj_grad_norm(x, m_grad, lb, ub);
         if(fpast > 0)
             m_fx[0] = fx;
 
@@ -148,9 +165,11 @@ public:
         }
 
         // Compute generalized Cauchy point
-        Vector xcp(n), vecc;
-        IndexSet newact_set, fv_set;
-        Cauchy<Scalar>::get_cauchy_point(m_bfgs, x, m_grad, lb, ub, xcp, vecc, newact_set, fv_set);
+        Vector& xcp = m_xcp;
+        Vector& vecc = m_vecc;
+        IndexSet& newact_set = m_newact_set;
+        IndexSet& fv_set = m_fv_set;
+        m_cauchy.get_cauchy_point(m_bfgs, x, m_grad, lb, ub, xcp, vecc, newact_set, fv_set);
 
         /* Vector gcp(n);
         Scalar fcp = f(xcp, gcp);
@@ -164,7 +183,8 @@ public:
         // Tolerance for s'y >= eps * (y'y)
         const Scalar eps = std::numeric_limits<Scalar>::epsilon();
         // s and y vectors
-        Vector vecs(n), vecy(n);
+        Vector& vecs = m_vecs;
+        Vector& vecy = m_vecy;
         // Number of iterations used
         int k = 1;
         for( ; ; )
@@ -179,6 +199,7 @@ public:
             Scalar step = Scalar(1);
             step = std::min(step, step_max);
             LineSearch<Scalar>::LineSearch(f, fx, x, m_grad, step, step_max, m_drt, m_xp, m_param);
+            m_iterations = k;
 
             // New projected gradient norm
             projgnorm = proj_grad_norm(x, m_grad, lb, ub);
@@ -216,7 +237,7 @@ public:
                 m_bfgs.add_correction(vecs, vecy);
 
             force_bounds(x, lb, ub);
-            Cauchy<Scalar>::get_cauchy_point(m_bfgs, x, m_grad, lb, ub, xcp, vecc, newact_set, fv_set);
+            m_cauchy.get_cauchy_point(m_bfgs, x, m_grad, lb, ub, xcp, vecc, newact_set, fv_set);
 
             /*Vector gcp(n);
             Scalar fcp = f(xcp, gcp);
@@ -224,7 +245,7 @@ public:
             std::cout << "xcp = " << xcp.transpose() << std::endl;
             std::cout << "f(xcp) = " << fcp << ", ||proj_grad|| = " << projgcpnorm << std::endl << std::endl;*/
 
-            SubspaceMin<Scalar>::subspace_minimize(m_bfgs, x, xcp, m_grad, lb, ub,
+            m_subspace.subspace_minimize(m_bfgs, x, xcp, m_grad, lb, ub,
                 vecc, newact_set, fv_set, m_param.max_submin, m_drt);
 
             /*Vector gsm(n);
@@ -238,6 +259,18 @@ public:
 
         return k;
     }
+
+    ///
+    /// Returning the infinity norm of the final projected gradient, which tells whether the
+    /// last call of minimize() met the gradient convergence test.
+    ///
+    Scalar final_grad_norm() const { return m_projgnorm; }
+
+    ///
+    /// Returning the number of iterations completed by the last call of minimize(), which is
+    /// still available when the line search or the objective function threw an exception.
+    ///
+    int iterations() const { return m_iterations; }
 };
 
 
@@ -50,6 +50,17 @@ private:
     //========== The following members are only used in L-BFGS-B algorithm ==========//
     Matrix                      m_permMinv;     // Permutated M inverse
     BKLDLT<Scalar>              m_permMsolver;  // Represents the permutated M matrix
+    // Workspace of the products below, kept between calls so that they do not allocate memory
+    // once the number of corrections and the size of the index sets stop changing
+    mutable Vector              m_vpadding;     // Padded vector solved with m_permMsolver
+    mutable Vector              m_Mv;           // M * v
+    mutable Vector              m_Wv;           // W' * v
+    mutable Vector              m_Pv;           // v[P]
+    mutable IndexSet            m_P_reduced;    // Indices of the non-zero elements of v[P]
+    mutable std::vector<Scalar> m_v_reduced;    // Non-zero elements of v[P]
+    mutable Matrix              m_mid;          // Middle matrix of solve_PtBP()
+    mutable Vector              m_midcol;       // Products filling a column of m_mid
+    mutable BKLDLT<Scalar>      m_midsolver;    // Represents m_mid
 
 public:
     // Constructor
@@ -74,6 +85,10 @@ public:
             m_permMinv.resize(2 * m, 2 * m);
             m_permMinv.setZero();
             m_permMinv.diagonal().setOnes();
+            m_vpadding.resize(2 * m);
+            m_midcol.resize(2 * m);
+            m_P_reduced.reserve(n);
+            m_v_reduced.reserve(n);
         }
     }
 
@@ -108,9 +123,8 @@ public:
 
             // Update S'S
             // We only store S'S in Minv, and multiply theta when LU decomposition is performed
-            Vector Ss = m_s.leftCols(m_ncorr).transpose() * m_s.col(loc);
-            m_permMinv.block(m_m + loc, m_m, 1, m_ncorr).noalias() = Ss.transpose();
-            m_permMinv.block(m_m, m_m + loc, m_ncorr, 1).noalias() = Ss;
+            m_permMinv.block(m_m, m_m + loc, m_ncorr, 1).noalias() = m_s.leftCols(m_ncorr).transpose() * m_s.col(loc);
+            m_permMinv.block(m_m + loc, m_m, 1, m_ncorr).noalias() = m_permMinv.block(m_m, m_m + loc, m_ncorr, 1).transpose();
 
             // Compute L
             // L = [          0                                     ]
@@ -200,22 +214,35 @@ public:
     // Return as a column vector
     inline Vector Wb(int b) const
     {
-        Vector res(2 * m_ncorr);
+        Vector res;
+        Wb(b, res);
+        return res;
+    }
+    // The same as above, writing the row to res
+    inline void Wb(int b, Vector& res) const
+    {
+        res.resize(2 * m_ncorr);
         for(int j = 0; j < m_ncorr; j++)
         {
             res[j] = m_y(b, j);
             res[m_ncorr + j] = m_s(b, j);
         }
         res.tail(m_ncorr) *= m_theta;
-        return res;
     }
 
     // Extract rows of W
     inline Matrix Wb(const IndexSet& b) const
+    {
+        Matrix res;
+        Wb(b, res);
+        return res;
+    }
+    // The same as above, writing the rows to res
+    inline void Wb(const IndexSet& b, Matrix& res) const
     {
         const int nb = b.size();
         const int* bptr = b.data();
-        Matrix res(nb, 2 * m_ncorr);
+        res.resize(nb, 2 * m_ncorr);
 
         for(int j = 0; j < m_ncorr; j++)
         {
@@ -230,7 +257,6 @@ public:
                 resSptr[i] = Sptr[row];
             }
         }
-        return res;
     }
 
     // M is [(2*ncorr) x (2*ncorr)], v is [(2*ncorr) x 1]
@@ -240,7 +266,8 @@ public:
         if(m_ncorr < 1)
             return;
 
-        Vector vpadding = Vector::Zero(2 * m_m);
+        Vector& vpadding = m_vpadding;
+        vpadding.setZero();
         vpadding.head(m_ncorr).noalias() = v.head(m_ncorr);
         vpadding.segment(m_m, m_ncorr).noalias() = v.tail(m_ncorr);
 
@@ -262,11 +289,12 @@ public:
         int nP = P_set.size();
 
         // Remove zeros in v to save computation
-        IndexSet P_reduced;
-        std::vector<Scalar> v_reduced;
+        IndexSet& P_reduced = m_P_reduced;
+        std::vector<Scalar>& v_reduced = m_v_reduced;
         if(test_zero)
         {
-            P_reduced.reserve(nP);
+            P_reduced.clear();
+            v_reduced.clear();
             for(int i = 0; i < nP; i++)
             {
                 if(vptr[i] != Scalar(0))
@@ -316,7 +344,7 @@ public:
         if(m_ncorr < 1 || nP < 1)
             return false;
 
-        Vector Mv;
+        Vector& Mv = m_Mv;
         apply_Mv(v, Mv);
         // WP * Mv
         Mv.tail(m_ncorr) *= m_theta;
@@ -345,7 +373,7 @@ public:
             return false;
         }
 
-        Vector Mv;
+        Vector& Mv = m_Mv;
         apply_Mv(v, Mv);
         // WP * Mv
         Mv.tail(m_ncorr) *= m_theta;
@@ -374,17 +402,20 @@ public:
         }
 
         // W'AA'd
-        Vector rhs(2 * m_ncorr);
+        Vector& rhs = m_Wv;
+        rhs.resize(2 * m_ncorr);
         if(nact <= nfree)
         {
             // Construct A'd
-            Vector Ad(nfree);
+            Vector& Ad = m_Pv;
+            Ad.resize(nfree);
             for(int i = 0; i < nact; i++)
                 Ad[i] = drt[newact_set[i]];
             apply_WtPv(newact_set, Ad, rhs);
         } else {
             // Construct F'd
-            Vector Fd(nfree);
+            Vector& Fd = m_Pv;
+            Fd.resize(nfree);
             for(int i = 0; i < nfree; i++)
                 Fd[i] = drt[fv_set[i]];
             // Compute W'AA'd = W'd - WF' * (F'd)
@@ -413,30 +444,37 @@ public:
 
         // Compute the matrix in the middle (only the lower triangular part is needed)
         // Remember that W = [Y, theta * S], but we do not store theta in WP
-        Matrix mid(2 * m_ncorr, 2 * m_ncorr);
+        Matrix& mid = m_mid;
+        mid.resize(2 * m_ncorr, 2 * m_ncorr);
         // [0:(ncorr - 1), 0:(ncorr - 1)]
         for(int j = 0; j < m_ncorr; j++)
         {
+            m_midcol.head(m_ncorr - j).noalias() = WP.block(0, j, nP, m_ncorr - j).transpose() * WP.col(j);
             mid.col(j).segment(j, m_ncorr - j).noalias() = m_permMinv.col(j).segment(j, m_ncorr - j) -
-                WP.block(0, j, nP, m_ncorr - j).transpose() * WP.col(j) / m_theta;
+                m_midcol.head(m_ncorr - j) / m_theta;
         }
         // [ncorr:(2 * ncorr - 1), 0:(ncorr - 1)]
-        mid.block(m_ncorr, 0, m_ncorr, m_ncorr).noalias() = m_permMinv.block(m_m, 0, m_ncorr, m_ncorr) -
-            WP.rightCols(m_ncorr).transpose() * WP.leftCols(m_ncorr);
+        mid.block(m_ncorr, 0, m_ncorr, m_ncorr).noalias() = WP.rightCols(m_ncorr).transpose() * WP.leftCols(m_ncorr);
+        mid.block(m_ncorr, 0, m_ncorr, m_ncorr) = m_permMinv.block(m_m, 0, m_ncorr, m_ncorr) -
+            mid.block(m_ncorr, 0, m_ncorr, m_ncorr);
         // [ncorr:(2 * ncorr - 1), ncorr:(2 * ncorr - 1)]
         for(int j = 0; j < m_ncorr; j++)
         {
+            m_midcol.head(m_ncorr - j).noalias() = WP.rightCols(m_ncorr - j).transpose() * WP.col(m_ncorr + j);
             mid.col(m_ncorr + j).segment(m_ncorr + j, m_ncorr - j).noalias() = m_theta *
-                (m_permMinv.col(m_m + j).segment(m_m + j, m_ncorr - j) - WP.rightCols(m_ncorr - j).transpose() * WP.col(m_ncorr + j));
+                (m_permMinv.col(m_m + j).segment(m_m + j, m_ncorr - j) - m_midcol.head(m_ncorr - j));
         }
         // Factorization
-        BKLDLT<Scalar> midsolver(mid);
+        BKLDLT<Scalar>& midsolver = m_midsolver;
+        midsolver.compute(mid);
         // Compute the final result
-        Vector WPv = WP.transpose() * v;
+        Vector& WPv = m_Wv;
+        WPv.noalias() = WP.transpose() * v;
         WPv.tail(m_ncorr) *= m_theta;
         midsolver.solve_inplace(WPv);
         WPv.tail(m_ncorr) *= m_theta;
-        res.noalias() = v / m_theta + (WP * WPv) / (m_theta * m_theta);
+        res.noalias() = WP * WPv;
+        res = v / m_theta + res / (m_theta * m_theta);
     }
 
     // Compute P'BQv, where P and Q are two mutually exclusive index selection operators
@@ -453,7 +491,7 @@ public:
             return false;
         }
 
-        Vector WQtv;
+        Vector& WQtv = m_Wv;
         bool nonzero = apply_WtPv(Q_set, v, WQtv, test_zero);
         if(!nonzero)
         {
@@ -461,7 +499,7 @@ public:
             return false;
         }
 
-        Vector MWQtv;
+        Vector& MWQtv = m_Mv;
         apply_Mv(WQtv, MWQtv);
         MWQtv.tail(m_ncorr) *= m_theta;
         res.noalias() = -WP * MWQtv;
@@ -480,9 +518,10 @@ public:
         }
 
         // Remember that W = [Y, theta * S], so we need to multiply theta to the second half
-        Vector WQtv = WQ.transpose() * v;
+        Vector& WQtv = m_Wv;
+        WQtv.noalias() = WQ.transpose() * v;
         WQtv.tail(m_ncorr) *= m_theta;
-        Vector MWQtv;
+        Vector& MWQtv = m_Mv;
         apply_Mv(WQtv, MWQtv);
         MWQtv.tail(m_ncorr) *= m_theta;
         res.noalias() = -WP * MWQtv;
@@ -60,6 +60,15 @@ private:
     typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
     typedef std::vector<int> IndexSet;
 
+    // Workspace kept between calls, so that the computation does not allocate memory once the
+    // number of corrections stops changing
+    Vector   m_brk;    // Break points
+    Vector   m_vecd;   // Search direction
+    IndexSet m_ord;    // Coordinates sorted by their break points
+    Vector   m_vecp;   // p = W'd
+    Vector   m_cache;  // M * p or M * w
+    Vector   m_wact;   // Row of W of the coordinate becoming active
+
     // Find the smallest index i such that brk[ord[i]] > t, assuming brk[ord] is already sorted.
     // If the return value equals n, then all values are <= t.
     static int search_greater(const Vector& brk, const IndexSet& ord, const Scalar& t, int start = 0)
@@ -85,7 +94,7 @@ public:
     // vecc:       c = W'(xcp - x0), used in the subspace minimization routine.
     // newact_set: Coordinates that newly become active during the GCP procedure.
     // fv_set:     Free variable set.
-    static void get_cauchy_point(
+    void get_cauchy_point(
         const BFGSMat<Scalar, true>& bfgs, const Vector& x0, const Vector& g, const Vector& lb, const Vector& ub,
         Vector& xcp, Vector& vecc, IndexSet& newact_set, IndexSet& fv_set
     )
@@ -104,11 +113,15 @@ public:
         fv_set.reserve(n);
 
         // Construct break points
-        Vector brk(n), vecd(n);
+        Vector& brk = m_brk;
+        Vector& vecd = m_vecd;
+        brk.resize(n);
+        vecd.resize(n);
         // If brk[i] == 0, i belongs to active set
         // If brk[i] == Inf, i belongs to free variable set
         // Others are currently undecided
-        IndexSet ord;
+        IndexSet& ord = m_ord;
+        ord.clear();
         ord.reserve(n);
         const Scalar inf = std::numeric_limits<Scalar>::infinity();
         for(int i = 0; i < n; i++)
@@ -151,12 +164,12 @@ public:
         // In case ord is empty, we take iu=Inf
 
         // p = W'd, c = 0
-        Vector vecp;
+        Vector& vecp = m_vecp;
         bfgs.apply_Wtv(vecd, vecp);
         // f' = -d'd
         Scalar fp = -vecd.squaredNorm();
         // f'' = -theta * f' - p'Mp
-        Vector cache;
+        Vector& cache = m_cache;
         bfgs.apply_Mv(vecp, cache);  // cache = Mp
         Scalar fpp = -bfgs.theta() * fp - vecp.dot(cache);
 
@@ -182,7 +195,8 @@ public:
         // 4. Move to the next interval and compute the new deltatmin
         bool crossed_all = false;
         const int ncorr = bfgs.num_corrections();
-        Vector wact(2 * ncorr);
+        Vector& wact = m_wact;
+        wact.resize(2 * ncorr);
         while(deltatmin >= deltat)
         {
             // Step 1
@@ -227,7 +241,7 @@ public:
                 const Scalar zact = xcp[act] - x0[act];
                 const Scalar gact = g[act];
                 const Scalar ggact = gact * gact;
-                wact.noalias() = bfgs.Wb(act);
+                bfgs.Wb(act, wact);
                 bfgs.apply_Mv(wact, cache);  // cache = Mw
                 fp += ggact + bfgs.theta() * gact * zact - gact * cache.dot(vecc);
                 fpp -= (bfgs.theta() * ggact + 2 * gact * cache.dot(vecp) + ggact * cache.dot(wact));
@@ -40,14 +40,33 @@ private:
     typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
     typedef std::vector<int> IndexSet;
 
-    // v[ind]
-    static Vector subvec(const Vector& v, const IndexSet& ind)
+    // Workspace kept between calls, so that the minimization does not allocate memory once the
+    // number of corrections and the sizes of the index sets stop changing
+    Matrix   m_WF;         // Rows of W in the free variable set
+    Matrix   m_WP;         // Rows of W in the P set
+    Vector   m_vecc;       // Linear term
+    Vector   m_vecl;       // Lower bounds of the free variables
+    Vector   m_vecu;       // Upper bounds of the free variables
+    Vector   m_vecy;       // Solution on the free variables
+    Vector   m_yfallback;  // Unconstrained solution on the free variables
+    Vector   m_lambda;     // Dual variables of the lower bounds
+    Vector   m_mu;         // Dual variables of the upper bounds
+    Vector   m_rhs;        // Right hand side of the system on the P set
+    Vector   m_lL;         // l[L]
+    Vector   m_uU;         // u[U]
+    Vector   m_tmp;        // Products on the P set
+    Vector   m_Fy;         // W' * F * y
+    Vector   m_res;        // Products on the L and U sets
+    Vector   m_sub;        // Subvectors of the linear term
+    IndexSet m_L_set, m_U_set, m_P_set, m_yL_set, m_yU_set, m_yP_set;
+
+    // res = v[ind]
+    static void subvec(const Vector& v, const IndexSet& ind, Vector& res)
     {
         const int nsub = ind.size();
-        Vector res(nsub);
+        res.resize(nsub);
         for(int i = 0; i < nsub; i++)
             res[i] = v[ind[i]];
-        return res;
     }
 
     // v[ind] = rhs
@@ -121,7 +140,7 @@ public:
     // fv_set:     Free variable set.
     // maxit:      Maximum number of iterations.
     // drt:        The output direction vector, drt = xsm - x0.
-    static void subspace_minimize(
+    void subspace_minimize(
         const BFGSMat<Scalar, true>& bfgs, const Vector& x0, const Vector& xcp, const Vector& g,
         const Vector& lb, const Vector& ub, const Vector& Wd, const IndexSet& newact_set, const IndexSet& fv_set, int maxit,
         Vector& drt
@@ -144,12 +163,16 @@ public:
         // std::cout << "Free variable set = [ "; for(std::size_t i = 0; i < fv_set.size(); i++)  std::cout << fv_set[i] << " "; std::cout << "]\n\n";
 
         // Extract the rows of W in the free variable set
-        Matrix WF = bfgs.Wb(fv_set);
+        Matrix& WF = m_WF;
+        bfgs.Wb(fv_set, WF);
         // Compute F'BAb = -F'WMW'AA'd
-        Vector vecc(nfree);
+        Vector& vecc = m_vecc;
         bfgs.compute_FtBAb(WF, fv_set, newact_set, Wd, drt, vecc);
         // Set the vector c=F'BAb+F'g for linear term, and vectors l and u for the new bounds
-        Vector vecl(nfree), vecu(nfree);
+        Vector& vecl = m_vecl;
+        Vector& vecu = m_vecu;
+        vecl.resize(nfree);
+        vecu.resize(nfree);
         for(int i = 0; i < nfree; i++)
         {
             const int coord = fv_set[i];
@@ -157,9 +180,10 @@ public:
             vecu[i] = ub[coord] - x0[coord];
             vecc[i] += g[coord];
         }
-        // Solve y = -inv(B[F, F]) * c
-        Vector vecy(nfree);
-        bfgs.solve_PtBP(WF, -vecc, vecy);
+        // Solve y = -inv(B[F, F]) * c, negating the solution instead of c since the solution is linear in c
+        Vector& vecy = m_vecy;
+        bfgs.solve_PtBP(WF, vecc, vecy);
+        vecy = -vecy;
         // Test feasibility
         // If yes, then the solution has been found
         if(in_bounds(vecy, vecl, vecu))
@@ -170,12 +194,21 @@ public:
         // Otherwise, enter the iterations
 
         // Make a copy of y as a fallback solution
-        Vector yfallback = vecy;
+        Vector& yfallback = m_yfallback;
+        yfallback = vecy;
         // Dual variables
-        Vector lambda = Vector::Zero(nfree), mu = Vector::Zero(nfree);
+        Vector& lambda = m_lambda;
+        Vector& mu = m_mu;
+        lambda.setZero(nfree);
+        mu.setZero(nfree);
 
         // Iterations
-        IndexSet L_set, U_set, P_set, yL_set, yU_set, yP_set;
+        IndexSet& L_set = m_L_set;
+        IndexSet& U_set = m_U_set;
+        IndexSet& P_set = m_P_set;
+        IndexSet& yL_set = m_yL_set;
+        IndexSet& yU_set = m_yU_set;
+        IndexSet& yP_set = m_yP_set;
         L_set.reserve(nfree / 3); yL_set.reserve(nfree / 3);
         U_set.reserve(nfree / 3); yU_set.reserve(nfree / 3);
         P_set.reserve(nfree); yP_set.reserve(nfree);
@@ -220,15 +253,20 @@ public:
             std::cout << "   P = [ "; for(std::size_t i = 0; i < P_set.size(); i++)  std::cout << P_set[i] << " "; std::cout << "]\n\n"; */
 
             // Extract the rows of W in the P set
-            Matrix WP = bfgs.Wb(P_set);
+            Matrix& WP = m_WP;
+            bfgs.Wb(P_set, WP);
             // Solve y[P] = -inv(B[P, P]) * (B[P, L] * l[L] + B[P, U] * u[U] + c[P])
             const int nP = P_set.size();
             if(nP > 0)
             {
-                Vector rhs = subvec(vecc, yP_set);
-                Vector lL = subvec(vecl, yL_set);
-                Vector uU = subvec(vecu, yU_set);
-                Vector tmp(nP);
+                Vector& rhs = m_rhs;
+                Vector& lL = m_lL;
+                Vector& uU = m_uU;
+                Vector& tmp = m_tmp;
+                subvec(vecc, yP_set, rhs);
+                subvec(vecl, yL_set, lL);
+                subvec(vecu, yU_set, uU);
+                tmp.resize(nP);
                 bool nonzero = bfgs.apply_PtBQv(WP, L_set, lL, tmp, true);
                 if(nonzero)
                     rhs.noalias() += tmp;
@@ -236,30 +274,32 @@ public:
                 if(nonzero)
                     rhs.noalias() += tmp;
 
-                bfgs.solve_PtBP(WP, -rhs, tmp);
+                bfgs.solve_PtBP(WP, rhs, tmp);
+                tmp = -tmp;
                 subvec_assign(vecy, yP_set, tmp);
             }
 
             // Solve lambda[L] = B[L, F] * y + c[L]
             const int nL = L_set.size();
             const int nU = U_set.size();
-            Vector Fy;
+            Vector& Fy = m_Fy;
+            Vector& res = m_res;
             if(nL > 0 || nU > 0)
                 bfgs.apply_WtPv(fv_set, vecy, Fy);
             if(nL > 0)
             {
-                Vector res;
                 bfgs.apply_PtWMv(L_set, Fy, res, Scalar(-1));
-                res.noalias() += subvec(vecc, yL_set);
+                subvec(vecc, yL_set, m_sub);
+                res.noalias() += m_sub;
                 subvec_assign(lambda, yL_set, res);
             }
 
             // Solve mu[U] = -B[U, F] * y - c[U]
             if(nU > 0)
             {
-                Vector res;
                 bfgs.apply_PtWMv(U_set, Fy, res, Scalar(-1));
-                res.noalias() = -res - subvec(vecc, yU_set);
+                subvec(vecc, yU_set, m_sub);
+                res.noalias() = -res - m_sub;
                 subvec_assign(mu, yU_set, res);
             }
 
@@ -47,7 +47,11 @@ Rcpp::List find_anchorpoints(const Eigen::MatrixXd& data, const size_t& n_pieces
  * \param epsilon the value of the bandwidth parameter epsilon
  * \param n_angles the number of the angles for the grid
  * \param n_intervals the number of intervals for the grid
- * \param kernel_id the type of kernel to be used
+ * \param kernel_id the type of kernel to be used. The kernel matrix of the compact ones is returned as a sparse matrix
+ * \param cutoff in each anchor point ignore the points whose kernel weight is less than cutoff times the largest one.
+ * If 0 all the points are used
+ * \param method how to accumulate the sample variogram: "pairs" walks the list of the pairs of points, "sparse" uses
+ * products between the kernel matrix and one sparse matrix for each cell of the grid
  * \param print if set to true print on console the time required to process the output
  * \param n_threads the number of threads to be used by OPENMP. If negative, let OPENMP autonomously decide how many
  * threads to open
@@ -55,7 +59,7 @@ Rcpp::List find_anchorpoints(const Eigen::MatrixXd& data, const size_t& n_pieces
 // [[Rcpp::export]]
 Rcpp::List variogramlsm(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, const Eigen::MatrixXd& anchorpoints,
     const double& epsilon, const size_t& n_angles, const size_t& n_intervals, const std::string& kernel_id,
-    const bool print, const int& n_threads)
+    const double& cutoff, const std::string& method, const bool print, const int& n_threads)
 {
     // start the clock
     auto start = high_resolution_clock::now();
@@ -75,7 +79,7 @@ Rcpp::List variogramlsm(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, c
     vectorptr zz = std::make_shared<vector>(z);
     matrixptr anchorpointsptr = std::make_shared<matrix>(anchorpoints);
 
-    SampleVar samplevar_(kernel_id, n_angles, n_intervals, epsilon);
+    SampleVar samplevar_(kernel_id, n_angles, n_intervals, epsilon, cutoff, method);
     // build the sample variogram
     samplevar_.build_samplevar(dd, anchorpointsptr, zz);
     // stop the clock and calculate the processing time
@@ -85,12 +89,27 @@ Rcpp::List variogramlsm(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, c
     if (print)
         Rcpp::Rcout << "task successfully completed in " << duration.count() << "ms" << std::endl;
 
-    return Rcpp::List::create(Rcpp::Named("kernel") = *(samplevar_.get_kernel()),
-        Rcpp::Named("grid") = *(samplevar_.get_grid()), Rcpp::Named("mean.x") = *(samplevar_.get_x()),
-        Rcpp::Named("mean.y") = *(samplevar_.get_y()),
+    // write the pairs inside the grid as a matrix with a row for each pair: the (1-based) indices of the two points and
+    // the index of the cell of the grid they belong to
+    const pairlist& pairs = *(samplevar_.get_grid());
+    matrixI grid(pairs.second.size(), 3);
+    for (size_t i = 0; i + 1 < pairs.rowstart.size(); ++i) {
+        for (size_t p = pairs.rowstart[i]; p < pairs.rowstart[i + 1]; ++p) {
+            grid(p, 0) = i + 1;
+            grid(p, 1) = pairs.second[p] + 1;
+            grid(p, 2) = pairs.cell[p];
+        }
+    }
+
+    // a compact kernel is returned as a sparse matrix, so that its size depends only on its support
+    SEXP kernel = samplevar_.is_kernel_sparse() ? Rcpp::wrap(*(samplevar_.get_sparse_kernel()))
+                                                : Rcpp::wrap(*(samplevar_.get_kernel()));
+
+    return Rcpp::List::create(Rcpp::Named("kernel") = kernel, Rcpp::Named("grid") = grid,
+        Rcpp::Named("mean.x") = *(samplevar_.get_x()), Rcpp::Named("mean.y") = *(samplevar_.get_y()),
         Rcpp::Named("squaredweigths") = *(samplevar_.get_squaredweights()),
         Rcpp::Named("empiricvariogram") = *(samplevar_.get_variogram()), Rcpp::Named("anchorpoints") = anchorpoints,
-        Rcpp::Named("epsilon") = epsilon);
+        Rcpp::Named("epsilon") = epsilon, Rcpp::Named("droppedmass") = *(samplevar_.get_dropped_mass()));
 }
 
 /**
@@ -109,6 +128,13 @@ Rcpp::List variogramlsm(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, c
  * lowerdelta*epsilon 
  * \param upperdelta set the maximum value for Cross-Validation search for optimal delta in smoothing
  * equal to upperdelta*epsilon 
+ * \param warm_start if set to true the anchor points are visited one wavefront at a time along the diagonals of their
+ * grid and the optimizer in each of them starts from the solution of the nearest anchor point already solved
+ * \param solver the optimizer to be used, "lbfgsb" for L-BFGS-B or "lm" for Levenberg-Marquardt
+ * \param max_iterations the number of iterations allowed to the optimizer in each anchor point
+ * \param max_evaluations the number of evaluations of the objective function allowed in each anchor point
+ * \param time_limit the number of seconds allowed for the whole fit. The anchor points exceeding one of these limits
+ * keep the best parameters found so far, each limit is ignored if it is infinite
  * \param print if set to true print on console the time required to process the output
  * \param n_threads the number of threads to be used by OPENMP. If negative, let OPENMP autonomously decide how many
  * threads to open
@@ -118,7 +144,9 @@ Rcpp::List findsolutionslsm(const Eigen::MatrixXd& anchorpoints, const Eigen::Ma
     const Eigen::MatrixXd& squaredweights, const Eigen::VectorXd& mean_x, const Eigen::VectorXd& mean_y,
     std::string& variogram_id, const std::string& kernel_id, const Eigen::VectorXd& parameters,
     const Eigen::VectorXd& lowerbound, const Eigen::VectorXd& upperbound, const double& epsilon,
-    const double& lowerdelta, const double& upperdelta, const bool print, const int& n_threads)
+    const double& lowerdelta, const double& upperdelta, const bool warm_start, const std::string& solver,
+    const double& max_iterations, const double& max_evaluations, const double& time_limit, const bool print,
+    const int& n_threads)
 {
     // start the clock
     auto start = high_resolution_clock::now();
@@ -140,9 +168,15 @@ Rcpp::List findsolutionslsm(const Eigen::MatrixXd& anchorpoints, const Eigen::Ma
     vectorptr yptr = std::make_shared<vector>(mean_y);
     matrixptr anchorpointsptr = std::make_shared<matrix>(anchorpoints);
 
-    Opt opt_(empiricvariogramptr, squaredweightsptr, xptr, yptr, variogram_id, parameters, lowerbound, upperbound);
+    Opt opt_(
+        empiricvariogramptr, squaredweightsptr, xptr, yptr, variogram_id, parameters, lowerbound, upperbound, solver);
+    opt_.set_budget(max_iterations, max_evaluations, time_limit);
     // solve the nonlinaear optimization problems and store the solutions inside opt_
-    opt_.findallsolutions();
+    if (warm_start) {
+        opt_.findallsolutions(anchorpointsptr);
+    } else {
+        opt_.findallsolutions();
+    }
     // build the smoother and find delta by cross-validation
     Smt smt_(opt_.get_solutions(), anchorpointsptr, lowerdelta * epsilon, upperdelta * epsilon, kernel_id);
 
@@ -151,11 +185,23 @@ Rcpp::List findsolutionslsm(const Eigen::MatrixXd& anchorpoints, const Eigen::Ma
     auto stop = high_resolution_clock::now();
     auto duration = duration_cast<milliseconds>(stop - start);
 
-    if (print)
+    if (print) {
+        const vector& busytimes = *(opt_.get_busy_times());
+        Rcpp::Rcout << "threads busy between " << busytimes.minCoeff() << "ms and " << busytimes.maxCoeff()
+                    << "ms while fitting the variogram" << std::endl;
         Rcpp::Rcout << "task successfully completed in " << duration.count() << "ms" << std::endl;
+    }
+
+    // one row for each anchor point describing how its fit went
+    Rcpp::DataFrame telemetry = Rcpp::DataFrame::create(Rcpp::Named("iterations") = *(opt_.get_iterations()),
+        Rcpp::Named("evaluations") = *(opt_.get_evaluations()),
+        Rcpp::Named("gradient_evaluations") = *(opt_.get_gradient_evaluations()),
+        Rcpp::Named("objective") = *(opt_.get_objective()), Rcpp::Named("status") = *(opt_.get_status()),
+        Rcpp::Named("time") = *(opt_.get_times()));
 
     return Rcpp::List::create(Rcpp::Named("solutions") = *(opt_.get_solutions()), Rcpp::Named("delta") = delta_ottimale,
-        Rcpp::Named("epsilon") = epsilon, Rcpp::Named("anchorpoints") = anchorpoints);
+        Rcpp::Named("epsilon") = epsilon, Rcpp::Named("anchorpoints") = anchorpoints,
+        Rcpp::Named("telemetry") = telemetry, Rcpp::Named("busy_times") = *(opt_.get_busy_times()));
 }
 
 /**
@@ -169,6 +215,8 @@ Rcpp::List findsolutionslsm(const Eigen::MatrixXd& anchorpoints, const Eigen::Ma
  * \param positions the position in which to perform the kriging
  * \param variogram_id the variogram to be used
  * \param kernel_id the kernel to be used inside the smoother
+ * \param truncation when smoothing the parameters ignore the anchor points farther than truncation times delta. If 0
+ * use all of them
  * \param print if set to true print on console the time required to process the output
  * \param n_threads the number of threads to be used by OPENMP. If negative, let OPENMP autonomously decide how many
  * threads to open
@@ -176,7 +224,8 @@ Rcpp::List findsolutionslsm(const Eigen::MatrixXd& anchorpoints, const Eigen::Ma
 // [[Rcpp::export]]
 Rcpp::List predikt(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, const Eigen::MatrixXd& anchorpoints,
     const double& epsilon, const double& delta, const Eigen::MatrixXd& solutions, const Eigen::MatrixXd& positions,
-    const std::string& variogram_id, const std::string& kernel_id, const bool print, const int& n_threads)
+    const std::string& variogram_id, const std::string& kernel_id, const double& truncation, const bool print,
+    const int& n_threads)
 {
     // start the clock
     auto start = high_resolution_clock::now();
@@ -197,7 +246,7 @@ Rcpp::List predikt(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, const
     matrixptr solutionsptr = std::make_shared<matrix>(solutions);
     matrixptr anchorpointsptr = std::make_shared<matrix>(anchorpoints);
 
-    Smt smt_(solutionsptr, anchorpointsptr, delta, kernel_id);
+    Smt smt_(solutionsptr, anchorpointsptr, delta, kernel_id, truncation);
     Predictor predictor_(variogram_id, zz, smt_, epsilon, dd);
     // predict the mean, the variance and the pointwise prediction of z in positions
     matrix predicted_ys(predictor_.predict_z<cd::matrix, cd::matrix>(positions));
@@ -220,12 +269,16 @@ Rcpp::List predikt(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, const
  * \param delta the value of delta regulating the smoothing
  * \param positions where to smooth the parameters
  * \param kernel_id the kernel to be used inside the smoother
+ * \param truncation ignore the anchor points farther than truncation times delta from each position, so that the cost
+ * of each position depends only on the anchor points near it. If 0 use all of them
  * \param n_threads the number of threads to be used by OPENMP. If negative, let OPENMP autonomously decide how many
  * threads to open
+ * \return a list with the matrix parameters holding the parameters smoothed in each position and the vector
+ * truncationerror holding the upper bound of the fraction of the kernel weight ignored in each position
  */
 // [[Rcpp::export]]
 Rcpp::List smoothing(const Eigen::MatrixXd solutions, const Eigen::MatrixXd& anchorpoints, const double& delta,
-    const Eigen::MatrixXd& positions, const std::string& kernel_id, const int& n_threads)
+    const Eigen::MatrixXd& positions, const std::string& kernel_id, const double& truncation, const int& n_threads)
 {
     // if n_threads is positive open open n_threads threads to process the data
     // otherwise let openmp decide autonomously how many threads use
@@ -242,13 +295,51 @@ Rcpp::List smoothing(const Eigen::MatrixXd solutions, const Eigen::MatrixXd& anc
     matrixptr solutionsptr = std::make_shared<matrix>(solutions);
     matrixptr anchorpointsptr = std::make_shared<matrix>(anchorpoints);
 
-    Smt smt_(solutionsptr, anchorpointsptr, delta, kernel_id);
+    Smt smt_(solutionsptr, anchorpointsptr, delta, kernel_id, truncation);
+
+    vector truncationerror;
+    Eigen::MatrixXd result(smt_.smooth_matrix(positions, truncationerror));
 
-    Eigen::MatrixXd result(positions.rows(), solutions.cols());
-    #pragma omp parallel for
-    for (size_t i = 0; i < positions.rows(); ++i) {
-        result.row(i) = smt_.smooth_vector(positions.row(i));
+    return Rcpp::List::create(
+        Rcpp::Named("parameters") = result, Rcpp::Named("truncationerror") = truncationerror);
+}
+
+/**
+ * \brief find the value of the parameters regulating the variogram on the nodes of a regular raster
+ * \param solutions the solution of the nonlinear optimization problem returned by the previous function
+ * \param anchorpoints the coordinates of the anchorpoints in which the optimization problem has been solved
+ * \param delta the value of delta regulating the smoothing
+ * \param origin the coordinates of the first node of the raster
+ * \param spacing the distance between two adjacent nodes of the raster along x and along y
+ * \param nx the number of nodes of the raster along x
+ * \param ny the number of nodes of the raster along y
+ * \param kernel_id the kernel to be used inside the smoother
+ * \param n_threads the number of threads to be used by OPENMP. If negative, let OPENMP autonomously decide how many
+ * threads to open
+ */
+// [[Rcpp::export]]
+Rcpp::List smoothing_raster(const Eigen::MatrixXd& solutions, const Eigen::MatrixXd& anchorpoints, const double& delta,
+    const Eigen::VectorXd& origin, const Eigen::VectorXd& spacing, const size_t& nx, const size_t& ny,
+    const std::string& kernel_id, const int& n_threads)
+{
+    // if n_threads is positive open open n_threads threads to process the data
+    // otherwise let openmp decide autonomously how many threads use
+    // if n_threads is greater than the maximum number of threads available open all the threads accessible
+    if (n_threads > 0) {
+        int max_threads = omp_get_max_threads();
+        int used_threads = std::min(max_threads, n_threads);
+        Rcpp::Rcout << "desired: " << n_threads << std::endl;
+        Rcpp::Rcout << "max: " << max_threads << std::endl;
+        Rcpp::Rcout << "used: " << used_threads << std::endl;
+        omp_set_num_threads(used_threads);
     }
 
+    matrixptr solutionsptr = std::make_shared<matrix>(solutions);
+    matrixptr anchorpointsptr = std::make_shared<matrix>(anchorpoints);
+
+    Smt smt_(solutionsptr, anchorpointsptr, delta, kernel_id);
+
+    Eigen::MatrixXd result(smt_.smooth_raster(origin(0), origin(1), spacing(0), spacing(1), nx, ny));
+
     return Rcpp::List::create(Rcpp::Named("parameters") = result);
 }
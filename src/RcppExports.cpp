@@ -24,8 +24,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // variogramlsm
-Rcpp::List variogramlsm(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, const Eigen::MatrixXd& anchorpoints, const double& epsilon, const size_t& n_angles, const size_t& n_intervals, const std::string& kernel_id, const bool print, const int& n_threads);
-RcppExport SEXP _LocallyStationaryModels_variogramlsm(SEXP zSEXP, SEXP dataSEXP, SEXP anchorpointsSEXP, SEXP epsilonSEXP, SEXP n_anglesSEXP, SEXP n_intervalsSEXP, SEXP kernel_idSEXP, SEXP printSEXP, SEXP n_threadsSEXP) {
+Rcpp::List variogramlsm(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, const Eigen::MatrixXd& anchorpoints, const double& epsilon, const size_t& n_angles, const size_t& n_intervals, const std::string& kernel_id, const double& cutoff, const std::string& method, const bool print, const int& n_threads);
+RcppExport SEXP _LocallyStationaryModels_variogramlsm(SEXP zSEXP, SEXP dataSEXP, SEXP anchorpointsSEXP, SEXP epsilonSEXP, SEXP n_anglesSEXP, SEXP n_intervalsSEXP, SEXP kernel_idSEXP, SEXP cutoffSEXP, SEXP methodSEXP, SEXP printSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -36,15 +36,17 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const size_t& >::type n_angles(n_anglesSEXP);
     Rcpp::traits::input_parameter< const size_t& >::type n_intervals(n_intervalsSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type kernel_id(kernel_idSEXP);
+    Rcpp::traits::input_parameter< const double& >::type cutoff(cutoffSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type method(methodSEXP);
     Rcpp::traits::input_parameter< const bool >::type print(printSEXP);
     Rcpp::traits::input_parameter< const int& >::type n_threads(n_threadsSEXP);
-    rcpp_result_gen = Rcpp::wrap(variogramlsm(z, data, anchorpoints, epsilon, n_angles, n_intervals, kernel_id, print, n_threads));
+    rcpp_result_gen = Rcpp::wrap(variogramlsm(z, data, anchorpoints, epsilon, n_angles, n_intervals, kernel_id, cutoff, method, print, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // findsolutionslsm
-Rcpp::List findsolutionslsm(const Eigen::MatrixXd& anchorpoints, const Eigen::MatrixXd& empiricvariogram, const Eigen::MatrixXd& squaredweights, const Eigen::VectorXd& mean_x, const Eigen::VectorXd& mean_y, std::string& variogram_id, const std::string& kernel_id, const Eigen::VectorXd& parameters, const Eigen::VectorXd& lowerbound, const Eigen::VectorXd& upperbound, const double& epsilon, const double& lowerdelta, const double& upperdelta, const bool print, const int& n_threads);
-RcppExport SEXP _LocallyStationaryModels_findsolutionslsm(SEXP anchorpointsSEXP, SEXP empiricvariogramSEXP, SEXP squaredweightsSEXP, SEXP mean_xSEXP, SEXP mean_ySEXP, SEXP variogram_idSEXP, SEXP kernel_idSEXP, SEXP parametersSEXP, SEXP lowerboundSEXP, SEXP upperboundSEXP, SEXP epsilonSEXP, SEXP lowerdeltaSEXP, SEXP upperdeltaSEXP, SEXP printSEXP, SEXP n_threadsSEXP) {
+Rcpp::List findsolutionslsm(const Eigen::MatrixXd& anchorpoints, const Eigen::MatrixXd& empiricvariogram, const Eigen::MatrixXd& squaredweights, const Eigen::VectorXd& mean_x, const Eigen::VectorXd& mean_y, std::string& variogram_id, const std::string& kernel_id, const Eigen::VectorXd& parameters, const Eigen::VectorXd& lowerbound, const Eigen::VectorXd& upperbound, const double& epsilon, const double& lowerdelta, const double& upperdelta, const bool warm_start, const std::string& solver, const double& max_iterations, const double& max_evaluations, const double& time_limit, const bool print, const int& n_threads);
+RcppExport SEXP _LocallyStationaryModels_findsolutionslsm(SEXP anchorpointsSEXP, SEXP empiricvariogramSEXP, SEXP squaredweightsSEXP, SEXP mean_xSEXP, SEXP mean_ySEXP, SEXP variogram_idSEXP, SEXP kernel_idSEXP, SEXP parametersSEXP, SEXP lowerboundSEXP, SEXP upperboundSEXP, SEXP epsilonSEXP, SEXP lowerdeltaSEXP, SEXP upperdeltaSEXP, SEXP warm_startSEXP, SEXP solverSEXP, SEXP max_iterationsSEXP, SEXP max_evaluationsSEXP, SEXP time_limitSEXP, SEXP printSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -61,15 +63,20 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const double& >::type epsilon(epsilonSEXP);
     Rcpp::traits::input_parameter< const double& >::type lowerdelta(lowerdeltaSEXP);
     Rcpp::traits::input_parameter< const double& >::type upperdelta(upperdeltaSEXP);
+    Rcpp::traits::input_parameter< const bool >::type warm_start(warm_startSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type solver(solverSEXP);
+    Rcpp::traits::input_parameter< const double& >::type max_iterations(max_iterationsSEXP);
+    Rcpp::traits::input_parameter< const double& >::type max_evaluations(max_evaluationsSEXP);
+    Rcpp::traits::input_parameter< const double& >::type time_limit(time_limitSEXP);
     Rcpp::traits::input_parameter< const bool >::type print(printSEXP);
     Rcpp::traits::input_parameter< const int& >::type n_threads(n_threadsSEXP);
-    rcpp_result_gen = Rcpp::wrap(findsolutionslsm(anchorpoints, empiricvariogram, squaredweights, mean_x, mean_y, variogram_id, kernel_id, parameters, lowerbound, upperbound, epsilon, lowerdelta, upperdelta, print, n_threads));
+    rcpp_result_gen = Rcpp::wrap(findsolutionslsm(anchorpoints, empiricvariogram, squaredweights, mean_x, mean_y, variogram_id, kernel_id, parameters, lowerbound, upperbound, epsilon, lowerdelta, upperdelta, warm_start, solver, max_iterations, max_evaluations, time_limit, print, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // predikt
-Rcpp::List predikt(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, const Eigen::MatrixXd& anchorpoints, const double& epsilon, const double& delta, const Eigen::MatrixXd& solutions, const Eigen::MatrixXd& positions, const std::string& variogram_id, const std::string& kernel_id, const bool print, const int& n_threads);
-RcppExport SEXP _LocallyStationaryModels_predikt(SEXP zSEXP, SEXP dataSEXP, SEXP anchorpointsSEXP, SEXP epsilonSEXP, SEXP deltaSEXP, SEXP solutionsSEXP, SEXP positionsSEXP, SEXP variogram_idSEXP, SEXP kernel_idSEXP, SEXP printSEXP, SEXP n_threadsSEXP) {
+Rcpp::List predikt(const Eigen::VectorXd& z, const Eigen::MatrixXd& data, const Eigen::MatrixXd& anchorpoints, const double& epsilon, const double& delta, const Eigen::MatrixXd& solutions, const Eigen::MatrixXd& positions, const std::string& variogram_id, const std::string& kernel_id, const double& truncation, const bool print, const int& n_threads);
+RcppExport SEXP _LocallyStationaryModels_predikt(SEXP zSEXP, SEXP dataSEXP, SEXP anchorpointsSEXP, SEXP epsilonSEXP, SEXP deltaSEXP, SEXP solutionsSEXP, SEXP positionsSEXP, SEXP variogram_idSEXP, SEXP kernel_idSEXP, SEXP truncationSEXP, SEXP printSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -82,15 +89,16 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const Eigen::MatrixXd& >::type positions(positionsSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type variogram_id(variogram_idSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type kernel_id(kernel_idSEXP);
+    Rcpp::traits::input_parameter< const double& >::type truncation(truncationSEXP);
     Rcpp::traits::input_parameter< const bool >::type print(printSEXP);
     Rcpp::traits::input_parameter< const int& >::type n_threads(n_threadsSEXP);
-    rcpp_result_gen = Rcpp::wrap(predikt(z, data, anchorpoints, epsilon, delta, solutions, positions, variogram_id, kernel_id, print, n_threads));
+    rcpp_result_gen = Rcpp::wrap(predikt(z, data, anchorpoints, epsilon, delta, solutions, positions, variogram_id, kernel_id, truncation, print, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // smoothing
-Rcpp::List smoothing(const Eigen::MatrixXd solutions, const Eigen::MatrixXd& anchorpoints, const double& delta, const Eigen::MatrixXd& positions, const std::string& kernel_id, const int& n_threads);
-RcppExport SEXP _LocallyStationaryModels_smoothing(SEXP solutionsSEXP, SEXP anchorpointsSEXP, SEXP deltaSEXP, SEXP positionsSEXP, SEXP kernel_idSEXP, SEXP n_threadsSEXP) {
+Rcpp::List smoothing(const Eigen::MatrixXd solutions, const Eigen::MatrixXd& anchorpoints, const double& delta, const Eigen::MatrixXd& positions, const std::string& kernel_id, const double& truncation, const int& n_threads);
+RcppExport SEXP _LocallyStationaryModels_smoothing(SEXP solutionsSEXP, SEXP anchorpointsSEXP, SEXP deltaSEXP, SEXP positionsSEXP, SEXP kernel_idSEXP, SEXP truncationSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -99,18 +107,39 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const double& >::type delta(deltaSEXP);
     Rcpp::traits::input_parameter< const Eigen::MatrixXd& >::type positions(positionsSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type kernel_id(kernel_idSEXP);
+    Rcpp::traits::input_parameter< const double& >::type truncation(truncationSEXP);
     Rcpp::traits::input_parameter< const int& >::type n_threads(n_threadsSEXP);
-    rcpp_result_gen = Rcpp::wrap(smoothing(solutions, anchorpoints, delta, positions, kernel_id, n_threads));
+    rcpp_result_gen = Rcpp::wrap(smoothing(solutions, anchorpoints, delta, positions, kernel_id, truncation, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// smoothing_raster
+Rcpp::List smoothing_raster(const Eigen::MatrixXd& solutions, const Eigen::MatrixXd& anchorpoints, const double& delta, const Eigen::VectorXd& origin, const Eigen::VectorXd& spacing, const size_t& nx, const size_t& ny, const std::string& kernel_id, const int& n_threads);
+RcppExport SEXP _LocallyStationaryModels_smoothing_raster(SEXP solutionsSEXP, SEXP anchorpointsSEXP, SEXP deltaSEXP, SEXP originSEXP, SEXP spacingSEXP, SEXP nxSEXP, SEXP nySEXP, SEXP kernel_idSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Eigen::MatrixXd& >::type solutions(solutionsSEXP);
+    Rcpp::traits::input_parameter< const Eigen::MatrixXd& >::type anchorpoints(anchorpointsSEXP);
+    Rcpp::traits::input_parameter< const double& >::type delta(deltaSEXP);
+    Rcpp::traits::input_parameter< const Eigen::VectorXd& >::type origin(originSEXP);
+    Rcpp::traits::input_parameter< const Eigen::VectorXd& >::type spacing(spacingSEXP);
+    Rcpp::traits::input_parameter< const size_t& >::type nx(nxSEXP);
+    Rcpp::traits::input_parameter< const size_t& >::type ny(nySEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type kernel_id(kernel_idSEXP);
+    Rcpp::traits::input_parameter< const int& >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(smoothing_raster(solutions, anchorpoints, delta, origin, spacing, nx, ny, kernel_id, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
     {"_LocallyStationaryModels_find_anchorpoints", (DL_FUNC) &_LocallyStationaryModels_find_anchorpoints, 2},
-    {"_LocallyStationaryModels_variogramlsm", (DL_FUNC) &_LocallyStationaryModels_variogramlsm, 9},
-    {"_LocallyStationaryModels_findsolutionslsm", (DL_FUNC) &_LocallyStationaryModels_findsolutionslsm, 15},
-    {"_LocallyStationaryModels_predikt", (DL_FUNC) &_LocallyStationaryModels_predikt, 11},
-    {"_LocallyStationaryModels_smoothing", (DL_FUNC) &_LocallyStationaryModels_smoothing, 6},
+    {"_LocallyStationaryModels_variogramlsm", (DL_FUNC) &_LocallyStationaryModels_variogramlsm, 11},
+    {"_LocallyStationaryModels_findsolutionslsm", (DL_FUNC) &_LocallyStationaryModels_findsolutionslsm, 20},
+    {"_LocallyStationaryModels_predikt", (DL_FUNC) &_LocallyStationaryModels_predikt, 12},
+    {"_LocallyStationaryModels_smoothing", (DL_FUNC) &_LocallyStationaryModels_smoothing, 7},
+    {"_LocallyStationaryModels_smoothing_raster", (DL_FUNC) &_LocallyStationaryModels_smoothing_raster, 9},
     {NULL, NULL, 0}
 };
 
@@ -39,7 +39,7 @@ private:
         // fill a vector with the position of each point
         Eigen::VectorXi result(n);
         for (size_t i = 0; i < n; ++i) {
-            cd::vector coordinates = m_data->row(i);
+            cd::vector2 coordinates = m_data->row(i);
             result(i) = ceil((coordinates(0) - m_origin_x) / m_piece_width)
                 + m_n_pieces * floor((coordinates(1) - m_origin_y) / m_piece_height);
         }
@@ -13,7 +13,7 @@ namespace LocallyStationaryModels {
 class Grid {
 private:
     cd::gridfunction m_f; ///< grid function
-    cd::matrixIptr m_g = std::make_shared<cd::matrixI>(0, 0); ///< grid matrix
+    cd::pairlistptr m_g = std::make_shared<cd::pairlist>(); ///< pairs of points inside the grid and their cells
     cd::vectorptr m_normh
         = nullptr; ///< vector with the norm of each cell of the grid (mean of the norm of all the pairs inside)
     cd::vectorptr m_mean_x
@@ -51,9 +51,9 @@ public:
     void build_grid(const cd::matrixptr& data, const size_t& n_angles, const size_t& n_intervals);
 
     /**
-     * \return a shared pointer to the grid
+     * \return a shared pointer to the list of the pairs of points inside the grid
      */
-    const cd::matrixIptr get_grid() const;
+    const cd::pairlistptr get_grid() const;
     /**
      * \return a shared pointer to m_normh
      */
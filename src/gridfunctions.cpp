@@ -2,41 +2,73 @@
 // Copyright (C) Giacomo De Carlo <giacomo.decarlo@mail.polimi.it>
 
 #include "gridfunctions.hpp"
+#include "spatialindex.hpp"
 
 namespace LocallyStationaryModels {
 using namespace cd;
 
 namespace gf {
-    matrixIptr pizza(const matrixptr& data, const size_t& n_angles, const size_t& n_intervals, const double& epsilon)
+    pairlistptr pizza(const matrixptr& data, const size_t& n_angles, const size_t& n_intervals, const double& epsilon)
     {
         double pi = Tolerances::pi;
-        // create a square matrix of dimension data->rows()^2 and fill it with -1
-        matrixIptr grid(std::make_shared<matrixI>(matrixI::Constant(data->rows(), data->rows(), -1)));
+        size_t n = data->rows();
         // b is the radius of locally stationary neighbourhood as function of bandwidth parameter epsilon
         double b = 2 * epsilon;
         double cell_length = b / n_intervals;
         double cell_angle = pi / (n_angles);
 
-        // for every couple of points i and j in data compute the position of the vector (j - i) in the grid and fill grid(i, j)
-        // accordingly since grid is symmetric we only need to fill the upper triangular part of the matrix
-        #pragma omp parallel for
-        for (size_t i = 0; i < data->rows() - 1; ++i) {
-            for (size_t j = i + 1; j < data->rows(); ++j) {
-                double deltax = data->operator()(j, 0) - data->operator()(i, 0);
-                double deltay = data->operator()(j, 1) - data->operator()(i, 1);
-                double radius = std::sqrt(deltax * deltax + deltay * deltay);
-
-                if (radius >= b) {
-                    grid->operator()(i, j) = -1;
-                } else if (deltax != 0) {
-                    grid->operator()(i, j) = floor(radius / cell_length)
-                        + n_intervals * floor((pi / 2 + std::atan(deltay / deltax)) / cell_angle);
-                } else {
-                    grid->operator()(i, j) = floor(radius / cell_length);
+        pairlistptr pairs(std::make_shared<pairlist>());
+        pairs->rowstart.assign(n + 1, 0);
+        // each thread collects its own pairs; since the rows are statically scheduled every thread gets a contiguous
+        // block of rows and the buffers can be concatenated in the order of the threads
+        std::vector<vectorind> second(omp_get_max_threads());
+        std::vector<vectorind> cell(omp_get_max_threads());
+
+        // bucket the points in cells of side b so that only the points in the neighbouring buckets have to be visited
+        SpatialIndex index(data, b);
+
+        // for every couple of points i and j in data compute the position of the vector (j - i) in the grid and store
+        // the pair only if it falls inside the grid, since the grid is symmetric we only need the pairs with i < j
+        #pragma omp parallel
+        {
+            int t = omp_get_thread_num();
+            vectorind neighbours;
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; ++i) {
+                index.find_neighbours(data->operator()(i, 0), data->operator()(i, 1), b, neighbours);
+                for (const size_t& j : neighbours) {
+                    if (j <= i) {
+                        continue;
+                    }
+                    double deltax = data->operator()(j, 0) - data->operator()(i, 0);
+                    double deltay = data->operator()(j, 1) - data->operator()(i, 1);
+                    double radius = std::sqrt(deltax * deltax + deltay * deltay);
+
+                    if (radius >= b) {
+                        continue;
+                    } else if (deltax != 0) {
+                        cell[t].push_back(floor(radius / cell_length)
+                            + n_intervals * floor((pi / 2 + std::atan(deltay / deltax)) / cell_angle));
+                    } else {
+                        cell[t].push_back(floor(radius / cell_length));
+                    }
+                    second[t].push_back(j);
+                    pairs->rowstart[i + 1]++;
                 }
             }
         }
-        return grid;
+
+        // turn the number of pairs in each row into the position of the first pair of the row
+        for (size_t i = 0; i < n; ++i) {
+            pairs->rowstart[i + 1] += pairs->rowstart[i];
+        }
+        pairs->second.reserve(pairs->rowstart[n]);
+        pairs->cell.reserve(pairs->rowstart[n]);
+        for (size_t t = 0; t < second.size(); ++t) {
+            pairs->second.insert(pairs->second.end(), second[t].begin(), second[t].end());
+            pairs->cell.insert(pairs->cell.end(), cell[t].begin(), cell[t].end());
+        }
+        return pairs;
     }
 
     gridfunction make_grid(const std::string& id) { return pizza; }
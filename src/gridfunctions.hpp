@@ -19,8 +19,9 @@ namespace gf {
      * \param n_angles number of slices of the pizza
      * \param n_intervals number of the pieces for each slice of the pizza
      * \param epsilon bandwidth parameter epsilon. Same of the kernel
+     * \return the list of the pairs of points closer than 2 * epsilon together with the cell of the grid they belong to
      */
-    cd::matrixIptr pizza(
+    cd::pairlistptr pizza(
         const cd::matrixptr& data, const size_t& n_angles, const size_t& n_intervals, const double& epsilon);
 
     /**
@@ -2,7 +2,6 @@
 // Copyright (C) Giacomo De Carlo <giacomo.decarlo@mail.polimi.it>
 
 #include "kernel.hpp"
-#include "kernelfunctions.hpp"
 
 namespace LocallyStationaryModels {
 using namespace cd;
@@ -14,61 +13,233 @@ Kernel::Kernel(const std::string& id, const double& epsilon)
 Kernel::Kernel()
     : Kernel("Gaussian", 1.) {};
 
-double Kernel::operator()(const vector& x, const vector& y) const { return m_f(x, y, m_epsilon); }
+double Kernel::operator()(const vector2& x, const vector2& y) const
+{
+    return std::visit([&](const auto& f) { return f(x, y, m_epsilon); }, m_f);
+}
 
-void Kernel::build_kernel(const matrixptr& data, const matrixptr& anchorpoints)
+template <class KernelFunction>
+void Kernel::build_sparse_kernel(const KernelFunction&, const matrixptr& rows, const matrixptr& cols)
+{
+    size_t N = rows->rows();
+    size_t n = cols->rows();
+    double radius = KernelFunction::support(m_epsilon);
+
+    // find the points of rows inside the support of each point of cols with a spatial index, so that the cost depends
+    // only on the number of non-zero elements. The radius is slightly enlarged because the index only returns the
+    // points strictly inside it, while a kernel such as the identity is not zero on the boundary of its support
+    SpatialIndex index(rows, radius);
+    std::vector<vectorind> supports(n);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t j = 0; j < n; ++j) {
+        index.find_neighbours(cols->operator()(j, 0), cols->operator()(j, 1),
+            radius * (1 + Tolerances::support_tolerance), supports[j]);
+    }
+
+    // m_sk is stored column by column and the indices found are sorted, so its arrays can be filled directly once the
+    // number of non-zero elements of each column is known
+    m_sk->resize(N, n);
+    size_t nonzeros = 0;
+    for (size_t j = 0; j < n; ++j) {
+        nonzeros += supports[j].size();
+        m_sk->outerIndexPtr()[j + 1] = nonzeros;
+    }
+    m_sk->resizeNonZeros(nonzeros);
+
+    // store the squared distances of each column in place of its values, then evaluate the kernel function on all of
+    // them with a single vectorised call
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t j = 0; j < n; ++j) {
+        vector2 x = cols->row(j);
+        size_t p = m_sk->outerIndexPtr()[j];
+        Eigen::Map<Eigen::ArrayXd> values(m_sk->valuePtr() + p, supports[j].size());
+        for (const size_t& i : supports[j]) {
+            vector2 y = rows->row(i);
+            m_sk->innerIndexPtr()[p] = i;
+            m_sk->valuePtr()[p] = (x - y).squaredNorm();
+            ++p;
+        }
+        values = KernelFunction::evaluate(values, m_epsilon);
+        vectorind().swap(supports[j]);
+    }
+    // remove the points found because of the enlargement of the radius
+    m_sk->prune([](const Eigen::Index&, const Eigen::Index&, const double& value) { return value != 0; });
+
+    m_k->resize(0, 0);
+}
+
+template <class KernelFunction>
+void Kernel::build_kernel(const KernelFunction& f, const matrixptr& data, const matrixptr& anchorpoints)
 {
     size_t n = data->rows();
 
-    size_t N = anchorpoints->rows();
+    Eigen::Index N = anchorpoints->rows();
+
+    if constexpr (KernelFunction::compact_support) {
+        build_sparse_kernel(f, anchorpoints, data);
 
+        // sum the elements of each row walking the non-zero elements column by column
+        std::vector<Eigen::ArrayXd> partialsums(omp_get_max_threads());
+        #pragma omp parallel
+        {
+            Eigen::ArrayXd& sums = partialsums[omp_get_thread_num()];
+            sums.setZero(N);
+            #pragma omp for schedule(static)
+            for (size_t j = 0; j < n; ++j) {
+                for (spmatrix::InnerIterator it(*m_sk, j); it; ++it) {
+                    sums(it.index()) += it.value();
+                }
+            }
+        }
+        Eigen::ArrayXd sums = Eigen::ArrayXd::Zero(N);
+        for (const Eigen::ArrayXd& partialsum : partialsums) {
+            if (partialsum.size() == N) {
+                sums += partialsum;
+            }
+        }
+        const Eigen::ArrayXd inverses = sums.inverse();
+
+        // divide each non-zero element by the sum of its row to obtain the normalized version of the kernel matrix K*
+        #pragma omp parallel for schedule(static)
+        for (size_t j = 0; j < n; ++j) {
+            for (spmatrix::InnerIterator it(*m_sk, j); it; ++it) {
+                it.valueRef() *= inverses(it.index());
+            }
+        }
+        return;
+    }
+
+    *m_sk = spmatrix(0, 0);
     m_k->resize(N, n);
 
-    // fill each component of m_k with the value of the kernel function evaluated between the i-th anchor point and the j-th
-    // initial point
-    #pragma omp parallel for
-    for (size_t i = 0; i < N; ++i) {
+    // store the coordinates of the anchor points as two separate contiguous arrays, so that a whole column of m_k can
+    // be computed with vectorised operations
+    const Eigen::ArrayXd ax = anchorpoints->col(0);
+    const Eigen::ArrayXd ay = anchorpoints->col(1);
+
+    // fill each column of m_k with the value of the kernel function evaluated between every anchor point and the j-th
+    // initial point and accumulate the sum of each row in the same pass. m_k is column-major, which is also the order
+    // in which SampleVar reads the weights of a block of anchor points
+    std::vector<Eigen::ArrayXd> partialsums(omp_get_max_threads());
+    #pragma omp parallel
+    {
+        Eigen::ArrayXd& sums = partialsums[omp_get_thread_num()];
+        sums.setZero(N);
+        #pragma omp for schedule(static)
         for (size_t j = 0; j < n; ++j) {
-            m_k->operator()(i, j) = this->operator()(anchorpoints->row(i), data->row(j));
+            double x = data->operator()(j, 0);
+            double y = data->operator()(j, 1);
+            auto column = m_k->col(j).array();
+            column = KernelFunction::evaluate((ax - x).square() + (ay - y).square(), m_epsilon);
+            sums += column;
         }
     }
 
-    // create a vector with the sum on each row of m_k
-    vector sums(N);
-    #pragma omp parallel for
-    for (size_t i = 0; i < N; ++i) {
-        sums(i) = (m_k->row(i)).sum();
+    // reduce the partial sums in the order of the threads so that the result does not depend on the scheduling
+    Eigen::ArrayXd sums = Eigen::ArrayXd::Zero(N);
+    for (const Eigen::ArrayXd& partialsum : partialsums) {
+        if (partialsum.size() == N) {
+            sums += partialsum;
+        }
     }
+    const Eigen::ArrayXd inverses = sums.inverse();
 
     // divide each element of m_k by the sum of the elements of its row to obtained the normalized version of the kernel
     // matrix K*
-    #pragma omp parallel for
-    for (size_t i = 0; i < N; ++i) {
-        for (size_t j = 0; j < n; ++j) {
-            m_k->operator()(i, j) /= sums(i);
-        }
+    #pragma omp parallel for schedule(static)
+    for (size_t j = 0; j < n; ++j) {
+        m_k->col(j).array() *= inverses;
     }
 }
 
-void Kernel::build_simple_kernel(const matrixptr& coordinates)
+void Kernel::build_kernel(const matrixptr& data, const matrixptr& anchorpoints)
+{
+    // select the kernel function once, so that the loops are compiled for its concrete type
+    std::visit([&](const auto& f) { build_kernel(f, data, anchorpoints); }, m_f);
+}
+
+template <class KernelFunction>
+void Kernel::build_simple_kernel(const KernelFunction& f, const matrixptr& coordinates)
 {
+    if constexpr (KernelFunction::compact_support) {
+        build_sparse_kernel(f, coordinates, coordinates);
+        return;
+    }
+
     size_t n = coordinates->rows();
+    *m_sk = spmatrix(0, 0);
     m_k->resize(n, n);
-    // fill each component of m_k with the kernel function evaluated between the i-th and the j-th point of d
+
+    const Eigen::ArrayXd cx = coordinates->col(0);
+    const Eigen::ArrayXd cy = coordinates->col(1);
+
+    // fill each column of m_k with the kernel function evaluated between every point and the j-th point of d
     #pragma omp parallel for
-    for (size_t i = 0; i < n; ++i) {
-        for (size_t j = i; j < n; ++j) {
-            m_k->operator()(i, j) = this->operator()(coordinates->row(i), coordinates->row(j));
-            m_k->operator()(j, i) = m_k->operator()(i, j);
-        }
+    for (size_t j = 0; j < n; ++j) {
+        double x = cx(j);
+        double y = cy(j);
+        m_k->col(j).array() = KernelFunction::evaluate((cx - x).square() + (cy - y).square(), m_epsilon);
     }
 }
 
+void Kernel::build_simple_kernel(const matrixptr& coordinates)
+{
+    std::visit([&](const auto& f) { build_simple_kernel(f, coordinates); }, m_f);
+}
+
 void Kernel::build_simple_kernel(const matrixptr& coordinates, const double& epsilon)
 {
     m_epsilon = epsilon;
     build_simple_kernel(coordinates);
 }
 
+void Kernel::evaluate(const matrix& rows, const matrix& cols, matrix& K) const
+{
+    K.resize(rows.rows(), cols.rows());
+    const Eigen::ArrayXd rx = rows.col(0);
+    const Eigen::ArrayXd ry = rows.col(1);
+
+    // fill each column of K with a single vectorised evaluation of the kernel function
+    std::visit(
+        [&](const auto& f) {
+            using KernelFunction = std::decay_t<decltype(f)>;
+            for (Eigen::Index j = 0; j < cols.rows(); ++j) {
+                K.col(j).array() = KernelFunction::evaluate(
+                    (rx - cols(j, 0)).square() + (ry - cols(j, 1)).square(), m_epsilon);
+            }
+        },
+        m_f);
+}
+
+void Kernel::evaluate_separable(const vector& rows, const vector& cols, matrix& K) const
+{
+    K.resize(rows.size(), cols.size());
+    std::visit(
+        [&](const auto& f) {
+            using KernelFunction = std::decay_t<decltype(f)>;
+            for (Eigen::Index j = 0; j < cols.size(); ++j) {
+                K.col(j).array() = KernelFunction::evaluate((rows.array() - cols(j)).square(), m_epsilon);
+            }
+        },
+        m_f);
+}
+
+bool Kernel::is_separable() const
+{
+    return std::visit([](const auto& f) { return std::decay_t<decltype(f)>::separable; }, m_f);
+}
+
+double Kernel::support() const
+{
+    return std::visit([&](const auto& f) { return f.support(m_epsilon); }, m_f);
+}
+
+bool Kernel::is_sparse() const
+{
+    return std::visit([](const auto& f) { return std::decay_t<decltype(f)>::compact_support; }, m_f);
+}
+
 const matrixptr Kernel::get_kernel() const { return m_k; }
+
+const spmatrixptr Kernel::get_sparse_kernel() const { return m_sk; }
 } // namespace LocallyStationaryModels
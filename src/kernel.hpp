@@ -4,6 +4,8 @@
 #ifndef LOCALLY_STATIONARY_MODELS_KERNEL
 #define LOCALLY_STATIONARY_MODELS_KERNEL
 
+#include "kernelfunctions.hpp"
+#include "spatialindex.hpp"
 #include "traits.hpp"
 
 namespace LocallyStationaryModels {
@@ -13,8 +15,38 @@ namespace LocallyStationaryModels {
 class Kernel {
 private:
     double m_epsilon; ///< bandwidth parameter
-    cd::kernelfunction m_f; ///< kernel function
-    cd::matrixptr m_k = std::make_shared<cd::matrix>(0, 0); ///< kernel matrix
+    kf::kernelfunction m_f; ///< kernel function
+    /// kernel matrix, used if the kernel has unbounded support
+    cd::matrixptr m_k = std::make_shared<cd::matrix>(0, 0);
+    /// kernel matrix, used if the kernel has compact support
+    cd::spmatrixptr m_sk = std::make_shared<cd::spmatrix>(0, 0);
+
+    /**
+     * \brief build the "star" version of the kernel for a specific kernel function
+     * \param f the kernel function, only used to select the type the loops are compiled for
+     * \param data a shared pointer to the matrix with the coordinates of the original dataset
+     * \param anchorpoints a shared pointer to the matrix with the coordinates of the anchor points
+     */
+    template <class KernelFunction>
+    void build_kernel(const KernelFunction& f, const cd::matrixptr& data, const cd::matrixptr& anchorpoints);
+
+    /**
+     * \brief build the "standard" version of the kernel for a specific kernel function
+     * \param f the kernel function, only used to select the type the loops are compiled for
+     * \param coordinates a shared pointer to the matrix with the coordinates
+     */
+    template <class KernelFunction> void build_simple_kernel(const KernelFunction& f, const cd::matrixptr& coordinates);
+
+    /**
+     * \brief fill m_sk with the kernel function evaluated between every point in rows and every point in cols, storing
+     * only the pairs of points closer than the support of the kernel
+     * \param f the kernel function, only used to select the type the loops are compiled for
+     * \param rows a shared pointer to the matrix with the coordinates of the points corresponding to the rows of m_sk
+     * \param cols a shared pointer to the matrix with the coordinates of the points corresponding to the columns of
+     * m_sk
+     */
+    template <class KernelFunction>
+    void build_sparse_kernel(const KernelFunction& f, const cd::matrixptr& rows, const cd::matrixptr& cols);
 
 public:
     /**
@@ -32,7 +64,7 @@ public:
     /**
      * \return m_f(x ,y) where m_f is the kernel function
      */
-    double operator()(const cd::vector& x, const cd::vector& y) const;
+    double operator()(const cd::vector2& x, const cd::vector2& y) const;
 
     /**
      * \brief build the "star" version of the kernel that contains the standardized kernel weights in such
@@ -56,9 +88,49 @@ public:
     void build_simple_kernel(const cd::matrixptr& coordinates, const double& epsilon);
 
     /**
-     * \return a shared pointer to the matrix pointed by m_k
+     * \brief fill K with the kernel function evaluated between every point in rows and every point in cols, stored as
+     * a dense matrix whatever the support of the kernel function
+     * \param rows the coordinates of the points corresponding to the rows of K
+     * \param cols the coordinates of the points corresponding to the columns of K
+     * \param K the matrix to fill, resized only if its size is not already the right one
+     */
+    void evaluate(const cd::matrix& rows, const cd::matrix& cols, cd::matrix& K) const;
+
+    /**
+     * \brief fill K with the kernel function evaluated on the squared differences between every value in rows and every
+     * value in cols. For a separable kernel function this is its factor along one coordinate
+     * \param rows the values corresponding to the rows of K
+     * \param cols the values corresponding to the columns of K
+     * \param K the matrix to fill, resized only if its size is not already the right one
+     */
+    void evaluate_separable(const cd::vector& rows, const cd::vector& cols, cd::matrix& K) const;
+
+    /**
+     * \return true if the kernel function evaluated in a lag (dx, dy) is the product of the kernel function evaluated
+     * in dx and in dy
+     */
+    bool is_separable() const;
+
+    /**
+     * \return the radius outside which the kernel is zero, infinite if its support is not compact
+     */
+    double support() const;
+
+    /**
+     * \return true if the kernel function has compact support, in which case the kernel matrix is stored in m_sk
+     * instead of m_k
+     */
+    bool is_sparse() const;
+
+    /**
+     * \return a shared pointer to the matrix pointed by m_k, empty if the kernel is sparse
      */
     const cd::matrixptr get_kernel() const;
+
+    /**
+     * \return a shared pointer to the matrix pointed by m_sk, empty if the kernel is not sparse
+     */
+    const cd::spmatrixptr get_sparse_kernel() const;
 }; // class Kernel
 } // namespace LocallyStationaryModels
 
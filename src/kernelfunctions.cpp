@@ -7,28 +7,20 @@ namespace LocallyStationaryModels {
 namespace kf {
     using namespace cd;
 
-    double gaussian(const vector& x, const vector& y, const double& epsilon)
-    {
-        return std::exp(-(x - y).squaredNorm() / (2 * epsilon * epsilon));
-    }
-
-    double identity(const vector& x, const vector& y, const double& epsilon)
-    {
-        if ((x - y).squaredNorm() > epsilon * epsilon) {
-            return 0;
-        } else {
-            return 1;
-        }
-    }
-
     kernelfunction make_kernel(const std::string& id)
     {
         if (id == "Gaussian" || id == "gaussian") {
-            return gaussian;
+            return Gaussian();
         } else if (id == "Identity" || id == "identity") {
-            return identity;
+            return Identity();
+        } else if (id == "Epanechnikov" || id == "epanechnikov") {
+            return Epanechnikov();
+        } else if (id == "Tricube" || id == "tricube") {
+            return Tricube();
+        } else if (id == "Wendland" || id == "wendland") {
+            return Wendland();
         } else {
-            return gaussian;
+            return Gaussian();
         }
     }
 } // namespace kf
@@ -6,6 +6,9 @@
 
 #include "traits.hpp"
 
+#include <limits>
+#include <variant>
+
 namespace LocallyStationaryModels {
 /**
  * Namespace kf
@@ -13,20 +16,227 @@ namespace LocallyStationaryModels {
  */
 namespace kf {
     /**
-     * \return e^(-norm(x-y)^2/epsilon^2)
+     * \brief gaussian kernel
      */
-    double gaussian(const cd::vector& x, const cd::vector& y, const double& epsilon);
+    struct Gaussian {
+        /// the gaussian kernel is positive everywhere, so the kernel matrix is stored as a dense matrix
+        static constexpr bool compact_support = false;
+        /// e^(-(dx^2+dy^2)/(2*epsilon^2)) is the product of the kernel evaluated on dx^2 and on dy^2
+        static constexpr bool separable = true;
+
+        /**
+         * \return the radius outside which the kernel is zero, infinite for the gaussian kernel
+         */
+        static double support(const double&) { return std::numeric_limits<double>::infinity(); }
+
+        /**
+         * \return e^(-squarednorm/(2*epsilon^2)) where squarednorm is the squared norm of x-y
+         */
+        static double evaluate(const double& squarednorm, const double& epsilon)
+        {
+            return std::exp(-squarednorm / (2 * epsilon * epsilon));
+        }
+
+        /**
+         * \return the coefficient-wise version of evaluate, computed with Eigen's vectorised exponential
+         */
+        template <class Derived>
+        static auto evaluate(const Eigen::ArrayBase<Derived>& squarednorms, const double& epsilon)
+        {
+            return (squarednorms * (-1 / (2 * epsilon * epsilon))).exp();
+        }
+
+        /**
+         * \return e^(-norm(x-y)^2/(2*epsilon^2))
+         */
+        double operator()(const cd::vector2& x, const cd::vector2& y, const double& epsilon) const
+        {
+            return evaluate((x - y).squaredNorm(), epsilon);
+        }
+    }; // struct Gaussian
+
+    /**
+     * \brief identity kernel
+     */
+    struct Identity {
+        /// the identity kernel is zero outside a disc, so the kernel matrix is stored as a sparse matrix
+        static constexpr bool compact_support = true;
+        /// the identity kernel is not the product of a function of dx and a function of dy
+        static constexpr bool separable = false;
+
+        /**
+         * \return the radius outside which the kernel is zero. The kernel is still one on the boundary of its support
+         */
+        static double support(const double& epsilon) { return epsilon; }
+
+        /**
+         * \return 1 only if squarednorm, the squared norm of x-y, is not greater than the square of epsilon
+         */
+        static double evaluate(const double& squarednorm, const double& epsilon)
+        {
+            if (squarednorm > epsilon * epsilon) {
+                return 0;
+            } else {
+                return 1;
+            }
+        }
+
+        /**
+         * \return the coefficient-wise version of evaluate
+         */
+        template <class Derived>
+        static auto evaluate(const Eigen::ArrayBase<Derived>& squarednorms, const double& epsilon)
+        {
+            return (squarednorms <= epsilon * epsilon).template cast<double>();
+        }
+
+        /**
+         * \return 1 only if the norm of the difference between x and y is not greater than epsilon
+         */
+        double operator()(const cd::vector2& x, const cd::vector2& y, const double& epsilon) const
+        {
+            return evaluate((x - y).squaredNorm(), epsilon);
+        }
+    }; // struct Identity
+
+    /**
+     * \brief Epanechnikov kernel
+     */
+    struct Epanechnikov {
+        /// the Epanechnikov kernel is zero outside a disc, so the kernel matrix is stored as a sparse matrix
+        static constexpr bool compact_support = true;
+        /// the Epanechnikov kernel is not the product of a function of dx and a function of dy
+        static constexpr bool separable = false;
+
+        /**
+         * \return the radius outside which the kernel is zero
+         */
+        static double support(const double& epsilon) { return epsilon; }
+
+        /**
+         * \return max(1 - squarednorm/epsilon^2, 0) where squarednorm is the squared norm of x-y
+         */
+        static double evaluate(const double& squarednorm, const double& epsilon)
+        {
+            return std::max(1 - squarednorm / (epsilon * epsilon), 0.);
+        }
+
+        /**
+         * \return the coefficient-wise version of evaluate
+         */
+        template <class Derived>
+        static auto evaluate(const Eigen::ArrayBase<Derived>& squarednorms, const double& epsilon)
+        {
+            return (1 - squarednorms * (1 / (epsilon * epsilon))).max(0.);
+        }
+
+        /**
+         * \return max(1 - norm(x-y)^2/epsilon^2, 0)
+         */
+        double operator()(const cd::vector2& x, const cd::vector2& y, const double& epsilon) const
+        {
+            return evaluate((x - y).squaredNorm(), epsilon);
+        }
+    }; // struct Epanechnikov
+
+    /**
+     * \brief tricube kernel
+     */
+    struct Tricube {
+        /// the tricube kernel is zero outside a disc, so the kernel matrix is stored as a sparse matrix
+        static constexpr bool compact_support = true;
+        /// the tricube kernel is not the product of a function of dx and a function of dy
+        static constexpr bool separable = false;
+
+        /**
+         * \return the radius outside which the kernel is zero
+         */
+        static double support(const double& epsilon) { return epsilon; }
+
+        /**
+         * \return max(1 - (norm/epsilon)^3, 0)^3 where norm is the square root of squarednorm, the squared norm of x-y
+         */
+        static double evaluate(const double& squarednorm, const double& epsilon)
+        {
+            double r = std::sqrt(squarednorm) / epsilon;
+            double t = std::max(1 - r * r * r, 0.);
+            return t * t * t;
+        }
+
+        /**
+         * \return the coefficient-wise version of evaluate
+         */
+        template <class Derived>
+        static auto evaluate(const Eigen::ArrayBase<Derived>& squarednorms, const double& epsilon)
+        {
+            return (1 - (squarednorms.sqrt() * (1 / epsilon)).cube()).max(0.).cube();
+        }
+
+        /**
+         * \return max(1 - (norm(x-y)/epsilon)^3, 0)^3
+         */
+        double operator()(const cd::vector2& x, const cd::vector2& y, const double& epsilon) const
+        {
+            return evaluate((x - y).squaredNorm(), epsilon);
+        }
+    }; // struct Tricube
+
+    /**
+     * \brief Wendland C2 kernel, which is positive definite in two dimensions
+     */
+    struct Wendland {
+        /// the Wendland kernel is zero outside a disc, so the kernel matrix is stored as a sparse matrix
+        static constexpr bool compact_support = true;
+        /// the Wendland kernel is not the product of a function of dx and a function of dy
+        static constexpr bool separable = false;
+
+        /**
+         * \return the radius outside which the kernel is zero
+         */
+        static double support(const double& epsilon) { return epsilon; }
+
+        /**
+         * \return max(1 - r, 0)^4 * (4r + 1) where r is the norm of x-y divided by epsilon and squarednorm is the
+         * squared norm of x-y
+         */
+        static double evaluate(const double& squarednorm, const double& epsilon)
+        {
+            double r = std::sqrt(squarednorm) / epsilon;
+            double t = std::max(1 - r, 0.);
+            return t * t * t * t * (4 * r + 1);
+        }
+
+        /**
+         * \return the coefficient-wise version of evaluate
+         */
+        template <class Derived>
+        static auto evaluate(const Eigen::ArrayBase<Derived>& squarednorms, const double& epsilon)
+        {
+            // r appears twice, so compute it once; the result is evaluated too since it must not refer to r
+            const Eigen::ArrayXd r = squarednorms.sqrt() * (1 / epsilon);
+            return Eigen::ArrayXd((1 - r).max(0.).square().square() * (4 * r + 1));
+        }
+
+        /**
+         * \return max(1 - norm(x-y)/epsilon, 0)^4 * (4 norm(x-y)/epsilon + 1)
+         */
+        double operator()(const cd::vector2& x, const cd::vector2& y, const double& epsilon) const
+        {
+            return evaluate((x - y).squaredNorm(), epsilon);
+        }
+    }; // struct Wendland
 
     /**
-     * \return 1 only if the norm of the difference between x and y is less the the square of epsilon
+     * \brief one of the kernel functions above. The hot loops use std::visit once to get the concrete type and are
+     * instantiated for it, so that the kernel function can be inlined
      */
-    double identity(const cd::vector& x, const cd::vector& y, const double& epsilon);
+    using kernelfunction = std::variant<Gaussian, Identity, Epanechnikov, Tricube, Wendland>;
 
     /**
      * \brief allow to select between pre-built kernel functions
      * \param id a string with the name of the kernel function you want to use
      */
-    cd::kernelfunction make_kernel(const std::string& id);
+    kernelfunction make_kernel(const std::string& id);
 } // namespace kf
 } // namespace LocallyStationaryModels
 
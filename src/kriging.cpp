@@ -10,7 +10,7 @@ vectorind Predictor::build_neighbourhood(const cd::vector& pos) const
 {
     vectorind n;
     for (size_t i = 0; i < m_data->rows(); ++i) {
-        vector datapos = m_data->row(i);
+        vector2 datapos = m_data->row(i);
         // if datapos is in a neighbourhood of radius m_b
         if ((pos - datapos).norm() < m_b) {
             n.push_back(i);
@@ -22,9 +22,9 @@ vectorind Predictor::build_neighbourhood(const cd::vector& pos) const
 vectorind Predictor::build_neighbourhood(const size_t& pos) const
 {
     vectorind n;
-    const vector& pospos = m_data->row(pos);
+    const vector2 pospos = m_data->row(pos);
     for (size_t i = 0; i < m_data->rows(); ++i) {
-        const vector& posi = m_data->row(i);
+        const vector2 posi = m_data->row(i);
         // if pos is in a neighbourhood of radius m_b
         if ((pospos - posi).norm() < m_b) {
             n.push_back(i);
@@ -33,20 +33,26 @@ vectorind Predictor::build_neighbourhood(const size_t& pos) const
     return n;
 }
 
-cd::vector Predictor::build_eta(cd::vector& params, vectorind& neighbourhood) const
+cd::vector Predictor::build_eta(const cd::vector& params, vectorind& neighbourhood) const
 {
     size_t n = neighbourhood.size();
     matrix gamma(n, n);
-    VariogramFunction& gammaiso = *(m_gammaisoptr);
-    // compute gamma
-    for (size_t i = 0; i < n; ++i) {
-        for (size_t j = 0; j < n; ++j) {
-            const vector& posi = m_data->row(neighbourhood[i]);
-            const vector& posj = m_data->row(neighbourhood[j]);
-            cd::vector s = posi - posj;
-            gamma(i, j) = gammaiso(params, s[0], s[1]);
-        }
-    }
+    // compute gamma with a local copy of the variogram function, whose parameters are set once and whose concrete type
+    // is selected once for the whole loop
+    std::visit(
+        [&](auto gammaiso) {
+            gammaiso.set_params(params);
+            gammaiso.prepare(n * n);
+            for (size_t i = 0; i < n; ++i) {
+                const vector2 posi = m_data->row(neighbourhood[i]);
+                for (size_t j = 0; j < n; ++j) {
+                    const vector2 posj = m_data->row(neighbourhood[j]);
+                    vector2 s = posi - posj;
+                    gamma(i, j) = gammaiso(s[0], s[1]);
+                }
+            }
+        },
+        m_gammaiso);
 
     vector ones = vector::Ones(n);
     // if gamma is not invertible, return ones/n
@@ -70,18 +76,24 @@ std::pair<cd::vector, double> Predictor::build_etakriging(const cd::vector& para
     vector C0(n);
     matrix correlationmatrix(n, n);
     double sigma2 = params[3] * params[3];
-    VariogramFunction& gammaiso = *(m_gammaisoptr);
+    const vector2 pos2 = pos;
     // compute the corralation matrix and C0
-    for (size_t i = 0; i < n; ++i) {
-        const vector& posi = m_data->row(i);
-        for (size_t j = 0; j < n; ++j) {
-            const vector& posj = m_data->row(j);
-            cd::vector s = posi - posj;
-            correlationmatrix(i, j) = sigma2 - gammaiso(params, s[0], s[1]);
-        }
-        cd::vector s0 = posi - pos;
-        C0(i) = sigma2 - gammaiso(params, s0[0], s0[1]);
-    }
+    std::visit(
+        [&](auto gammaiso) {
+            gammaiso.set_params(params);
+            gammaiso.prepare(n * (n + 1));
+            for (size_t i = 0; i < n; ++i) {
+                const vector2 posi = m_data->row(i);
+                for (size_t j = 0; j < n; ++j) {
+                    const vector2 posj = m_data->row(j);
+                    vector2 s = posi - posj;
+                    correlationmatrix(i, j) = sigma2 - gammaiso(s[0], s[1]);
+                }
+                vector2 s0 = posi - pos2;
+                C0(i) = sigma2 - gammaiso(s0[0], s0[1]);
+            }
+        },
+        m_gammaiso);
     // compute etakriging
     etakriging = correlationmatrix.colPivHouseholderQr().solve(C0);
     // compute the variance
@@ -89,10 +101,8 @@ std::pair<cd::vector, double> Predictor::build_etakriging(const cd::vector& para
     return std::make_pair(etakriging, krigingvariance);
 }
 
-template <> double Predictor::predict_mean<cd::vector, double>(const cd::vector& pos) const
+double Predictor::predict_mean(const cd::vector& pos, const cd::vector& params) const
 {
-    // find the value of the parameters in pos
-    cd::vector params = m_smt.smooth_vector(pos);
     // find the anchorpoints in its neighbourhood
     vectorind neighbourhood = build_neighbourhood(pos);
     size_t n = neighbourhood.size();
@@ -108,6 +118,12 @@ template <> double Predictor::predict_mean<cd::vector, double>(const cd::vector&
     return result;
 }
 
+template <> double Predictor::predict_mean<cd::vector, double>(const cd::vector& pos) const
+{
+    // find the value of the parameters in pos
+    return predict_mean(pos, m_smt.smooth_vector(pos));
+}
+
 template <> double Predictor::predict_mean<size_t, double>(const size_t& pos) const
 {
     // find the value of the parameters relative to the anchorpoint in row pos
@@ -129,23 +145,22 @@ template <> double Predictor::predict_mean<size_t, double>(const size_t& pos) co
 
 template <> cd::vector Predictor::predict_mean<cd::matrix, cd::vector>(const cd::matrix& pos) const
 {
+    // find the value of the parameters in all the positions at once
+    const matrix params = m_smt.smooth_matrix(pos);
     vector result(pos.rows());
     #pragma omp parallel for
     for (size_t i = 0; i < pos.rows(); ++i) {
-        result(i) = predict_mean<cd::vector, double>(pos.row(i));
+        result(i) = predict_mean(pos.row(i), params.row(i));
     }
     return result;
 }
 
-template <>
-std::pair<double, double> Predictor::predict_z<cd::vector, std::pair<double, double>>(const cd::vector& pos) const
+std::pair<double, double> Predictor::predict_z(const cd::vector& pos, const cd::vector& params) const
 {
     size_t n = m_data->rows();
     // predict the mean of z in pos
-    double m0 = predict_mean<cd::vector, double>(pos);
+    double m0 = predict_mean(pos, params);
     double result = m0;
-    // find the value of the parameters in pos
-    cd::vector params = m_smt.smooth_vector(pos);
     // build etakriging and calculate the variance
     std::pair<vector, double> fulletakriging(build_etakriging(params, pos));
     vector& etakriging = fulletakriging.first;
@@ -157,12 +172,21 @@ std::pair<double, double> Predictor::predict_z<cd::vector, std::pair<double, dou
     return std::make_pair(result, fulletakriging.second);
 }
 
+template <>
+std::pair<double, double> Predictor::predict_z<cd::vector, std::pair<double, double>>(const cd::vector& pos) const
+{
+    // find the value of the parameters in pos
+    return predict_z(pos, m_smt.smooth_vector(pos));
+}
+
 template <> cd::matrix Predictor::predict_z<cd::matrix, cd::matrix>(const cd::matrix& pos) const
 {
+    // find the value of the parameters in all the positions at once
+    const matrix params = m_smt.smooth_matrix(pos);
     matrix result(pos.rows(), 2);
     #pragma omp parallel for
     for (size_t i = 0; i < pos.rows(); ++i) {
-        std::pair<double, double> prediction = predict_z<cd::vector, std::pair<double, double>>(pos.row(i));
+        std::pair<double, double> prediction = predict_z(pos.row(i), params.row(i));
         result(i, 0) = prediction.first;
         result(i, 1) = prediction.second;
     }
@@ -171,20 +195,25 @@ template <> cd::matrix Predictor::predict_z<cd::matrix, cd::matrix>(const cd::ma
 
 Predictor::Predictor(
     const std::string& id, const cd::vectorptr& z, const Smt& mysmt, const double& b, const cd::matrixptr& data)
-    : m_gammaisoptr(make_variogramiso(id))
+    : m_gammaiso(make_variogramiso(id))
     , m_z(z)
     , m_smt(mysmt)
     , m_b(b)
     , m_data(data)
 {
+    // every prediction evaluates the variogram between pairs of points of the dataset: a variogram whose tables do not
+    // depend on the parameters can build them once here instead of in the copy made for each prediction
+    std::visit([&](auto& gammaiso) { gammaiso.prepare(m_data->rows() * m_data->rows()); }, m_gammaiso);
     m_means = std::make_shared<vector>(z->size());
-    // build a vector with the prediction of the mean of z in every anchorpoint to speed up the next computations
+    // build a vector with the prediction of the mean of z in every anchorpoint to speed up the next computations,
+    // smoothing the parameters in all of them at once
+    const matrix params = m_smt.smooth_matrix(*m_data);
     #pragma omp parallel for
     for (size_t i = 0; i < m_means->size(); ++i) {
-        m_means->operator()(i) = predict_mean<size_t, double>(i);
+        m_means->operator()(i) = predict_mean(m_data->row(i), params.row(i));
     }
 };
 
 Predictor::Predictor()
-    : m_gammaisoptr(make_variogramiso("esponenziale")) {}
+    : m_gammaiso(make_variogramiso("esponenziale")) {}
 } // namespace LocallyStationaryModels
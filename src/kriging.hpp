@@ -14,7 +14,7 @@ namespace LocallyStationaryModels {
  */
 class Predictor {
 private:
-    std::shared_ptr<VariogramFunction> m_gammaisoptr; ///< variogram function
+    variogramfunction m_gammaiso; ///< variogram function
     cd::vectorptr m_z = nullptr; ///< z(m_data)
     Smt m_smt; ///< smoother
     double m_b; ///< cutoff-radius of locally stationary neighbourhood
@@ -33,7 +33,7 @@ private:
      * \param params the params obtained by smoothing in the center of the neighbourhood
      * \param neighbourhood a "neighbourhood" vector build with the previous functions
      */
-    cd::vector build_eta(cd::vector& params, cd::vectorind& neighbourhood) const;
+    cd::vector build_eta(const cd::vector& params, cd::vectorind& neighbourhood) const;
 
     /**
      * \brief build the vector eta necessary to perform kriging on Y in a point
@@ -42,6 +42,21 @@ private:
      */
     std::pair<cd::vector, double> build_etakriging(const cd::vector& params, const cd::vector& pos) const;
 
+    /**
+     * \brief predict the mean in a point
+     * \param pos the coordinates of the point
+     * \param params the params already obtained by smoothing in pos
+     */
+    double predict_mean(const cd::vector& pos, const cd::vector& params) const;
+
+    /**
+     * \brief predict Z in a point
+     * \param pos the coordinates of the point
+     * \param params the params already obtained by smoothing in pos
+     * \return Z(pos) and the kriging variance
+     */
+    std::pair<double, double> predict_z(const cd::vector& pos, const cd::vector& params) const;
+
 public:
     /**
      * \brief constructor
@@ -0,0 +1,191 @@
+// Copyright (C) Luca Crippa <luca7.crippa@mail.polimi.it>
+// Copyright (C) Giacomo De Carlo <giacomo.decarlo@mail.polimi.it>
+
+#ifndef LOCALLY_STATIONARY_MODELS_LEVENBERGMARQUARDT
+#define LOCALLY_STATIONARY_MODELS_LEVENBERGMARQUARDT
+
+#include "traits.hpp"
+
+#include <stdexcept>
+
+namespace LocallyStationaryModels {
+/**
+ * \brief a Levenberg-Marquardt solver for bound constrained weighted least squares problems. At each iteration the
+ * Gauss-Newton system, damped by a multiple of its own diagonal, is solved on the parameters not held by an active
+ * bound and the step is projected on the box, so that problems with a handful of parameters are usually solved in few
+ * iterations
+ */
+class LMSolver {
+private:
+    double m_epsilon; ///< absolute tolerance on the infinity norm of the projected gradient
+    double m_epsilon_rel; ///< tolerance on the projected gradient relative to the norm of the parameters
+    size_t m_max_iterations; ///< maximum number of iterations, 0 for no limit
+    double m_projgnorm = 0; ///< infinity norm of the projected gradient in the point returned by minimize
+    size_t m_iterations = 0; ///< iterations completed by the last call of minimize, also when f threw
+    cd::matrix m_JtJ; ///< product of the transposed jacobian of the residuals and the jacobian
+    cd::matrix m_A; ///< damped Gauss-Newton matrix
+    cd::vector m_Jtr; ///< product of the transposed jacobian of the residuals and the residuals
+    cd::matrix m_JtJcandidate; ///< m_JtJ in the candidate point, swapped with m_JtJ if the candidate is accepted
+    cd::vector m_Jtrcandidate; ///< m_Jtr in the candidate point, swapped with m_Jtr if the candidate is accepted
+    cd::vector m_b; ///< right hand side of the damped Gauss-Newton system
+    cd::vector m_scaling; ///< largest diagonal of m_JtJ seen so far
+    cd::vector m_candidate; ///< candidate point
+    cd::vector m_step; ///< projected step from the current point to the candidate
+    cd::vector m_JtJstep; ///< product of m_JtJ and m_step
+    Eigen::LDLT<cd::matrix> m_ldlt; ///< factorization of m_A
+
+    /**
+     * \brief resize the workspace for problems with n parameters, which allocates memory only if n has changed
+     */
+    void reset(const Eigen::Index& n)
+    {
+        m_JtJ.resize(n, n);
+        m_A.resize(n, n);
+        m_Jtr.resize(n);
+        m_JtJcandidate.resize(n, n);
+        m_Jtrcandidate.resize(n);
+        m_b.resize(n);
+        m_scaling.resize(n);
+        m_candidate.resize(n);
+        m_step.resize(n);
+        m_JtJstep.resize(n);
+    }
+
+    /**
+     * \brief compute the infinity norm of the projected gradient in x, where the gradient of the objective is 2 * m_Jtr
+     * \param x the current point
+     * \param lb the lower bounds
+     * \param ub the upper bounds
+     */
+    double projected_gradient_norm(const cd::vector& x, const cd::vector& lb, const cd::vector& ub) const
+    {
+        return ((x - 2 * m_Jtr).cwiseMax(lb).cwiseMin(ub) - x).cwiseAbs().maxCoeff();
+    }
+
+public:
+    /**
+     * \brief constructor
+     * \param epsilon absolute tolerance on the infinity norm of the projected gradient
+     * \param epsilon_rel tolerance on the projected gradient relative to the norm of the parameters
+     * \param max_iterations maximum number of iterations, 0 for no limit
+     */
+    LMSolver(const double& epsilon, const double& epsilon_rel, const size_t& max_iterations)
+        : m_epsilon(epsilon)
+        , m_epsilon_rel(epsilon_rel)
+        , m_max_iterations(max_iterations) {};
+
+    /**
+     * \brief minimize the sum of the squared residuals of f inside the box [lb, ub]. The workspace of the solver is
+     * kept between calls, so that solving many problems of the same size does not allocate memory
+     * \tparam Function a functor with a method normal_equations(x, JtJ, Jtr) filling the Gauss-Newton matrix and the
+     * product of the transposed jacobian and the residuals and returning the objective
+     * \param f the least squares problem
+     * \param x the starting point, overwritten with the best point found
+     * \param fx overwritten with the value of the objective in x
+     * \param lb the lower bounds
+     * \param ub the upper bounds
+     * \return the number of iterations
+     */
+    template <class Function>
+    size_t minimize(Function& f, cd::vector& x, double& fx, const cd::vector& lb, const cd::vector& ub)
+    {
+        const Eigen::Index n = x.size();
+        if (lb.size() != n || ub.size() != n) {
+            throw std::invalid_argument("'lb' and 'ub' must have the same size as 'x'");
+        }
+        x = x.cwiseMax(lb).cwiseMin(ub);
+        reset(n);
+
+        fx = f.normal_equations(x, m_JtJ, m_Jtr);
+        if (!std::isfinite(fx)) {
+            throw std::runtime_error("the objective function is not finite in the starting point");
+        }
+
+        // the damping is scaled by the largest diagonal of JtJ seen so far, which makes the steps invariant to the
+        // very different magnitudes of the parameters (ranges against angles)
+        m_scaling = m_JtJ.diagonal();
+        double mu = Tolerances::lm_initial_damping;
+        double nu = 2;
+
+        size_t k = 0;
+        for (; m_max_iterations == 0 || k < m_max_iterations; ++k) {
+            m_iterations = k;
+            // the projected gradient is the same quantity tested by LBFGSpp
+            m_projgnorm = projected_gradient_norm(x, lb, ub);
+            if (m_projgnorm <= std::max(m_epsilon, m_epsilon_rel * x.norm())) {
+                break;
+            }
+
+            double floor = Tolerances::lm_scaling_floor * std::max(1., m_scaling.maxCoeff());
+            m_A = m_JtJ;
+            m_b = -m_Jtr;
+            for (Eigen::Index i = 0; i < n; ++i) {
+                m_A(i, i) += mu * std::max(m_scaling[i], floor);
+            }
+            // a parameter on a bound whose descent direction points outside the box is kept fixed, by replacing its
+            // equation with step_i = 0
+            for (Eigen::Index i = 0; i < n; ++i) {
+                if ((x[i] <= lb[i] && m_Jtr[i] > 0) || (x[i] >= ub[i] && m_Jtr[i] < 0)) {
+                    m_A.row(i).setZero();
+                    m_A.col(i).setZero();
+                    m_A(i, i) = 1;
+                    m_b[i] = 0;
+                }
+            }
+            m_ldlt.compute(m_A);
+            m_step = m_ldlt.solve(m_b);
+
+            m_candidate = (x + m_step).cwiseMax(lb).cwiseMin(ub);
+            m_step = m_candidate - x;
+            if (m_step.norm() <= Tolerances::lm_step_tolerance * (x.norm() + Tolerances::lm_step_tolerance)) {
+                break;
+            }
+
+            // reduction of the objective predicted by the Gauss-Newton model and the actual one
+            m_JtJstep.noalias() = m_JtJ * m_step;
+            double predicted = -(2 * m_step.dot(m_Jtr) + m_step.dot(m_JtJstep));
+            // the normal equations are built in the candidate together with the objective, so that an accepted candidate
+            // does not need a second evaluation. A candidate where the objective cannot be evaluated is rejected like
+            // one which does not decrease it, any other exception thrown by f is left to the caller
+            double fcandidate = std::numeric_limits<double>::infinity();
+            try {
+                fcandidate = f.normal_equations(m_candidate, m_JtJcandidate, m_Jtrcandidate);
+            } catch (std::runtime_error&) {
+            }
+            double rho = predicted > 0 ? (fx - fcandidate) / predicted : -1;
+
+            if (m_ldlt.info() == Eigen::Success && std::isfinite(fcandidate) && rho > 0) {
+                x = m_candidate;
+                fx = fcandidate;
+                m_JtJ.swap(m_JtJcandidate);
+                m_Jtr.swap(m_Jtrcandidate);
+                m_scaling = m_scaling.cwiseMax(m_JtJ.diagonal());
+                mu *= std::max(1. / 3, 1 - std::pow(2 * rho - 1, 3));
+                nu = 2;
+            } else {
+                mu *= nu;
+                nu *= 2;
+                if (mu > Tolerances::lm_max_damping) {
+                    break;
+                }
+            }
+        }
+        m_projgnorm = projected_gradient_norm(x, lb, ub);
+        m_iterations = k;
+        return k;
+    }
+
+    /**
+     * \return the infinity norm of the projected gradient in the point returned by the last call of minimize, which
+     * tells whether it met the convergence test
+     */
+    double final_grad_norm() const { return m_projgnorm; }
+
+    /**
+     * \return the number of iterations completed by the last call of minimize, which is still available when f threw
+     */
+    size_t iterations() const { return m_iterations; }
+}; // class LMSolver
+} // namespace LocallyStationaryModels
+
+#endif // LOCALLY_STATIONARY_MODELS_LEVENBERGMARQUARDT
@@ -12,68 +12,196 @@ void SampleVar::build_samplevar(const cd::matrixptr& data, const cd::matrixptr&
 
     m_kernel.build_kernel(data, anchorpoints);
 
-    // d is the matrix with the coordinates of the initial points
-    const matrix& d = *(data);
-    // z is the vector with z(d)
-    const vector& zz = *(z);
-    // a is the matrix with the coordinates of the anchor points
-    const matrix& a = *(anchorpoints);
-    const matrixIptr g = m_grid.get_grid();
-    const matrix& K = *(m_kernel.get_kernel());
+    const pairlist& pairs = *(m_grid.get_grid());
 
-    size_t n = g->rows();
+    size_t max_index = m_grid.get_normh()->size();
 
-    size_t max_index = g->maxCoeff();
+    size_t N = anchorpoints->rows();
 
-    size_t N = a.rows();
+    m_variogram = std::make_shared<matrix>(matrix::Zero(max_index, N));
+    m_denominators = std::make_shared<matrix>(matrix::Zero(max_index, N));
+    m_droppedmass = std::make_shared<vector>(vector::Zero(N));
 
-    m_variogram = std::make_shared<matrix>(matrix::Zero(max_index + 1, N));
-    m_denominators = std::make_shared<matrix>(matrix::Zero(max_index + 1, N));
+    if (m_method == "sparse") {
+        if (m_kernel.is_sparse()) {
+            build_sparse(*(m_kernel.get_sparse_kernel()), *(z));
+        } else {
+            build_sparse(*(m_kernel.get_kernel()), *(z));
+        }
+    } else if (m_kernel.is_sparse()) {
+        build_compact(*(z));
+    } else if (m_cutoff > 0) {
+        build_truncated(*(z));
+    } else {
+        build_blocked(*(z));
+    }
 
-    // Z is the matrix that contains the squared norm of the difference between each possible pair z_i and z_j
-    matrix Z(n, n);
+    // counters[k] is the number of pairs which fell in the k-th cell of the grid
+    Eigen::VectorXi counters = Eigen::VectorXi::Zero(max_index);
+    for (const size_t& k : pairs.cell) {
+        counters[k]++;
+    }
+    for (size_t u = 0; u < max_index; ++u) {
+        if (counters[u] != 0) {
+            m_variogram->row(u).array() /= (2 * m_denominators->row(u).array());
+        }
+    }
+    build_squaredweights();
+}
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < n; ++i) {
-        for (size_t j = 1; j < n; ++j) {
-            Z(i, j) = (zz(i) - zz(j)) * (zz(i) - zz(j));
-            Z(j, i) = Z(i, j);
+void SampleVar::build_blocked(const vector& zz)
+{
+    const pairlist& pairs = *(m_grid.get_grid());
+    const matrix& K = *(m_kernel.get_kernel());
+
+    size_t n = K.cols();
+    size_t N = K.rows();
+    size_t max_index = m_variogram->rows();
+
+    // the pairs are walked once for each block of anchors: since K is stored column by column, the weights of a block
+    // of anchors for the same point are contiguous in memory and can be updated together
+    const size_t block = Tolerances::anchors_per_block;
+    // each thread accumulates its own partial sums, which are then reduced in the order of the threads. With a static
+    // schedule every thread always receives the same rows, so the result does not change from run to run
+    std::vector<matrix> variograms(omp_get_max_threads());
+    std::vector<matrix> denominators(omp_get_max_threads());
+
+    for (size_t l0 = 0; l0 < N; l0 += block) {
+        size_t B = std::min(block, N - l0);
+        for (size_t t = 0; t < variograms.size(); ++t) {
+            variograms[t].setZero(B, max_index);
+            denominators[t].setZero(B, max_index);
+        }
+
+        #pragma omp parallel
+        {
+            matrix& variogram = variograms[omp_get_thread_num()];
+            matrix& denominator = denominators[omp_get_thread_num()];
+            vector prodotto(B);
+            // for every couple of locations in d whose lag falls inside the grid
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t p = pairs.rowstart[i]; p < pairs.rowstart[i + 1]; ++p) {
+                    size_t j = pairs.second[p];
+                    size_t k = pairs.cell[p];
+                    prodotto = K.col(i).segment(l0, B).cwiseProduct(K.col(j).segment(l0, B));
+                    // the squared difference between z_i and z_j is computed on the fly instead of being stored for
+                    // every possible pair
+                    double zdiff = zz(i) - zz(j);
+                    variogram.col(k) += prodotto * (zdiff * zdiff);
+                    denominator.col(k) += prodotto;
+                }
+            }
+        }
+
+        for (size_t t = 0; t < variograms.size(); ++t) {
+            m_variogram->middleCols(l0, B) += variograms[t].transpose();
+            m_denominators->middleCols(l0, B) += denominators[t].transpose();
         }
     }
+}
+
+void SampleVar::build_truncated(const vector& zz)
+{
+    const matrix& K = *(m_kernel.get_kernel());
+
+    size_t n = K.cols();
+    size_t N = K.rows();
 
     #pragma omp parallel
     {
-        int k = 0;
+        // weights[i] is the weight of the i-th point for the current anchor if the point is kept, 0 otherwise
+        vector weights = vector::Zero(n);
+        vectorind support;
         // for every location in d
-        #pragma omp for
+        #pragma omp for schedule(dynamic)
         for (size_t l = 0; l < N; ++l) {
-            Eigen::VectorXi counters = Eigen::VectorXi::Zero(max_index + 1);
-            // for every couple of locations in d
-            for (size_t i = 0; i < n - 1; ++i) {
-                for (size_t j = i + 1; j < n; ++j) {
-                    // if the vector between i and j belongs to the cell k
-                    k = g->operator()(i, j);
-                    if (k >= 0) {
-                        double prodotto = K(l, i) * K(l, j);
-                        m_variogram->operator()(k, l) += prodotto * Z(i, j);
-                        m_denominators->operator()(k, l) += prodotto;
-                        counters[k]++;
-                    }
+            // keep only the points whose weight is not negligible compared to the largest one
+            double threshold = m_cutoff * K.row(l).maxCoeff();
+            double dropped = 0;
+            support.clear();
+            for (size_t i = 0; i < n; ++i) {
+                if (K(l, i) >= threshold && K(l, i) > 0) {
+                    weights[i] = K(l, i);
+                    support.push_back(i);
+                } else {
+                    dropped += K(l, i);
                 }
             }
-            for (size_t u = 0; u < max_index + 1; ++u) {
-                if (counters[u] != 0) {
-                    m_variogram->operator()(u, l) /= (2 * m_denominators->operator()(u, l));
+            m_droppedmass->operator()(l) = dropped;
+
+            accumulate_anchor(l, support, weights, zz);
+
+            for (const size_t& i : support) {
+                weights[i] = 0;
+            }
+        }
+    }
+}
+
+void SampleVar::build_compact(const vector& zz)
+{
+    // the kernel matrix is transposed once so that the points in the support of each anchor are contiguous
+    const Eigen::SparseMatrix<double, Eigen::RowMajor> K = *(m_kernel.get_sparse_kernel());
+
+    size_t n = K.cols();
+    size_t N = K.rows();
+
+    #pragma omp parallel
+    {
+        vector weights = vector::Zero(n);
+        vectorind support;
+        // for every location in d
+        #pragma omp for schedule(dynamic)
+        for (size_t l = 0; l < N; ++l) {
+            // only the points inside the support of the kernel are stored, the cutoff may discard some more of them
+            double threshold = 0;
+            for (Eigen::SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(K, l); it; ++it) {
+                threshold = std::max(threshold, m_cutoff * it.value());
+            }
+            double dropped = 0;
+            support.clear();
+            for (Eigen::SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(K, l); it; ++it) {
+                if (it.value() >= threshold) {
+                    weights[it.index()] = it.value();
+                    support.push_back(it.index());
+                } else {
+                    dropped += it.value();
                 }
             }
+            m_droppedmass->operator()(l) = dropped;
+
+            accumulate_anchor(l, support, weights, zz);
+
+            for (const size_t& i : support) {
+                weights[i] = 0;
+            }
+        }
+    }
+}
+
+void SampleVar::accumulate_anchor(const size_t& l, const vectorind& support, const vector& weights, const vector& zz)
+{
+    const pairlist& pairs = *(m_grid.get_grid());
+
+    // for every couple of kept locations whose lag falls inside the grid
+    for (const size_t& i : support) {
+        for (size_t p = pairs.rowstart[i]; p < pairs.rowstart[i + 1]; ++p) {
+            size_t j = pairs.second[p];
+            if (weights[j] == 0) {
+                continue;
+            }
+            size_t k = pairs.cell[p];
+            double prodotto = weights[i] * weights[j];
+            double zdiff = zz(i) - zz(j);
+            m_variogram->operator()(k, l) += prodotto * zdiff * zdiff;
+            m_denominators->operator()(k, l) += prodotto;
         }
     }
-    build_squaredweights();
 }
 
 void SampleVar::build_squaredweights()
 {
-    const matrixIptr g = m_grid.get_grid();
     const vectorptr normh = m_grid.get_normh();
 
     size_t N = m_denominators->cols();
@@ -91,12 +219,93 @@ void SampleVar::build_squaredweights()
     }
 }
 
-SampleVar::SampleVar(
-    const std::string& kernel_id, const size_t& n_angles, const size_t& n_intervals, const double& epsilon)
+template <class KernelMatrix> void SampleVar::build_sparse(const KernelMatrix& K, const vector& zz)
+{
+    const pairlist& pairs = *(m_grid.get_grid());
+
+    size_t n = K.cols();
+    size_t N = K.rows();
+    size_t max_index = m_variogram->rows();
+
+    // A[k] is the sparse matrix with (z_i - z_j)^2 in position (i, j) for every pair (i, j) in the k-th cell, so that
+    // the sample variogram in the k-th cell is the diagonal of K * A[k] * K^T. Only its non-zero elements are stored,
+    // as a list of triplets
+    std::vector<std::vector<Eigen::Triplet<double>>> triplets(max_index);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t p = pairs.rowstart[i]; p < pairs.rowstart[i + 1]; ++p) {
+            size_t j = pairs.second[p];
+            double zdiff = zz(i) - zz(j);
+            triplets[pairs.cell[p]].emplace_back(i, j, zdiff * zdiff);
+        }
+    }
+
+    // every cell is processed by a single thread, which owns the corresponding row of the results
+    #pragma omp parallel
+    {
+        vector variogram(N);
+        vector denominator(N);
+        vector prodotto(N);
+        #pragma omp for schedule(dynamic)
+        for (size_t k = 0; k < max_index; ++k) {
+            if (triplets[k].empty()) {
+                continue;
+            }
+            variogram.setZero();
+            denominator.setZero();
+            // the diagonal of K * A[k] * K^T is the sum over the non-zero elements (i, j) of A[k] of A[k](i, j) times
+            // K.col(i) .* K.col(j), and the denominators are obtained in the same way replacing A[k](i, j) with one
+            for (const Eigen::Triplet<double>& t : triplets[k]) {
+                if constexpr (std::is_same_v<KernelMatrix, matrix>) {
+                    prodotto = K.col(t.row()).cwiseProduct(K.col(t.col()));
+                    variogram += prodotto * t.value();
+                    denominator += prodotto;
+                } else {
+                    // only the anchor points in the support of both points contribute: the two columns are merged
+                    // walking their sorted non-zero elements
+                    typename KernelMatrix::InnerIterator a(K, t.row());
+                    typename KernelMatrix::InnerIterator b(K, t.col());
+                    while (a && b) {
+                        if (a.index() < b.index()) {
+                            ++a;
+                        } else if (b.index() < a.index()) {
+                            ++b;
+                        } else {
+                            double weight = a.value() * b.value();
+                            variogram(a.index()) += weight * t.value();
+                            denominator(a.index()) += weight;
+                            ++a;
+                            ++b;
+                        }
+                    }
+                }
+            }
+            m_variogram->row(k) = variogram.transpose();
+            m_denominators->row(k) = denominator.transpose();
+            std::vector<Eigen::Triplet<double>>().swap(triplets[k]);
+        }
+    }
+}
+
+SampleVar::SampleVar(const std::string& kernel_id, const size_t& n_angles, const size_t& n_intervals,
+    const double& epsilon, const double& cutoff, const std::string& method)
     : m_kernel(kernel_id, epsilon)
     , m_grid("pizza", epsilon)
     , m_n_angles(n_angles)
-    , m_n_intervals(n_intervals) {};
+    , m_n_intervals(n_intervals)
+    , m_cutoff(cutoff)
+    , m_method(method)
+{
+    if (m_method != "pairs" && m_method != "sparse") {
+        throw std::invalid_argument("method must be either \"pairs\" or \"sparse\"");
+    }
+    if (m_method == "sparse" && m_cutoff > 0) {
+        throw std::invalid_argument("the cutoff is only supported by the \"pairs\" method");
+    }
+};
+
+SampleVar::SampleVar(
+    const std::string& kernel_id, const size_t& n_angles, const size_t& n_intervals, const double& epsilon)
+    : SampleVar(kernel_id, n_angles, n_intervals, epsilon, 0., "pairs") {};
 
 SampleVar::SampleVar()
     : m_kernel()
@@ -108,13 +317,19 @@ const matrixptr SampleVar::get_denominators() const { return m_denominators; }
 
 const matrixptr SampleVar::get_squaredweights() const { return m_squaredweights; }
 
+const vectorptr SampleVar::get_dropped_mass() const { return m_droppedmass; }
+
 const vectorptr SampleVar::get_x() const { return m_grid.get_x(); }
 
 const vectorptr SampleVar::get_y() const { return m_grid.get_y(); }
 
 const matrixptr SampleVar::get_kernel() const { return m_kernel.get_kernel(); }
 
-const matrixIptr SampleVar::get_grid() const { return m_grid.get_grid(); }
+const spmatrixptr SampleVar::get_sparse_kernel() const { return m_kernel.get_sparse_kernel(); }
+
+bool SampleVar::is_kernel_sparse() const { return m_kernel.is_sparse(); }
+
+const pairlistptr SampleVar::get_grid() const { return m_grid.get_grid(); }
 
 const vectorptr SampleVar::get_normh() const { return m_grid.get_normh(); }
 } // namespace LocallyStationaryModels
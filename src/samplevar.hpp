@@ -17,16 +17,60 @@ private:
     cd::matrixptr m_variogram = nullptr; ///< sample variogram matrix
     cd::matrixptr m_denominators = nullptr; ///< a matrix with the denominators necessary to compute the squared weights
     cd::matrixptr m_squaredweights = nullptr; ///< matrix with the squared weights
+    cd::vectorptr m_droppedmass = nullptr; ///< kernel weight discarded in each anchor point by the truncation
     Kernel m_kernel; ///< kernel
     Grid m_grid; ///< grid
     size_t m_n_angles; ///< number of angles of the grid
     size_t m_n_intervals; ///< number of intervals per angle of the grid
+    double m_cutoff = 0; ///< relative kernel weight below which a point is ignored, 0 to use all the points
+    std::string m_method = "pairs"; ///< how the sample variogram is accumulated, either "pairs" or "sparse"
 
     /**
      * \brief a "helper" function which built the squared weights for the wls problem needed by the optimizer
      */
     void build_squaredweights();
 
+    /**
+     * \brief accumulate the sample variogram walking the pairs once for every block of anchor points and updating the
+     * whole block at once
+     * \param zz the vector with the value of Z
+     */
+    void build_blocked(const cd::vector& zz);
+
+    /**
+     * \brief accumulate the sample variogram of each anchor point using only the pairs of points whose kernel weight is
+     * at least m_cutoff times the largest weight of the anchor, and store the discarded weight in m_droppedmass
+     * \param zz the vector with the value of Z
+     */
+    void build_truncated(const cd::vector& zz);
+
+    /**
+     * \brief accumulate the sample variogram of each anchor point using only the pairs of points inside the support of
+     * the kernel, read from its sparse kernel matrix, and apply m_cutoff to the remaining weights
+     * \param zz the vector with the value of Z
+     */
+    void build_compact(const cd::vector& zz);
+
+    /**
+     * \brief add to the l-th column of the sample variogram and of the denominators the contribution of the pairs of
+     * points both in support
+     * \param l the index of the anchor point
+     * \param support the indices of the points used for the l-th anchor point
+     * \param weights the kernel weight of each point in support for the l-th anchor point, 0 for every other point
+     * \param zz the vector with the value of Z
+     */
+    void accumulate_anchor(
+        const size_t& l, const cd::vectorind& support, const cd::vector& weights, const cd::vector& zz);
+
+    /**
+     * \brief accumulate the sample variogram of each cell of the grid as the diagonal of K * A * K^T, where A is the
+     * sparse matrix with the squared differences of the pairs in that cell, visiting only the non-zero elements of A
+     * and, with a sparse kernel, of K
+     * \param K the kernel matrix, either dense or sparse
+     * \param zz the vector with the value of Z
+     */
+    template <class KernelMatrix> void build_sparse(const KernelMatrix& K, const cd::vector& zz);
+
 public:
     /**
      * \brief constructor
@@ -37,6 +81,22 @@ public:
      */
     SampleVar(const std::string& kernel_id, const size_t& n_angles, const size_t& n_intervals, const double& epsilon);
 
+    /**
+     * \brief constructor
+     * \param kernel_id the name of the function you want to use for the kernel
+     * \param n_angles the number of angles to be passed to the grid
+     * \param n_intervals the number of inervals to be passed to the grid
+     * \param epsilon the bandwidth parameter regulating the kernel
+     * \param cutoff in each anchor point ignore the points whose kernel weight is less than cutoff times the largest
+     * one, so that only the pairs among the remaining points are visited. If 0 all the points are used (with a compact
+     * kernel only the points inside its support are used anyway). Only supported by the "pairs" method
+     * \param method "pairs" to accumulate the variogram walking the list of the pairs, "sparse" to compute it as the
+     * diagonal of the product between the kernel matrix, one sparse matrix for each cell of the grid and the transposed
+     * kernel matrix. Any other value throws std::invalid_argument, as does a positive cutoff with "sparse"
+     */
+    SampleVar(const std::string& kernel_id, const size_t& n_angles, const size_t& n_intervals, const double& epsilon,
+        const double& cutoff, const std::string& method);
+
     /**
      * \brief a default constructor for the class which calls the default constructors for both the kernel and the grid
      */
@@ -62,6 +122,11 @@ public:
      * \return a shared pointers to the squaredweigths required to evaluate the function to be optimized
      */
     const cd::matrixptr get_squaredweights() const;
+    /**
+     * \return a shared pointer to the vector with the fraction of the kernel weight discarded in each anchor point by
+     * the truncation (all zeros if the cutoff is 0)
+     */
+    const cd::vectorptr get_dropped_mass() const;
     /**
      * \return m_grid.m_mean_x
      */
@@ -74,10 +139,18 @@ public:
      * \return m_kernel.m_k
      */
     const cd::matrixptr get_kernel() const;
+    /**
+     * \return m_kernel.m_sk
+     */
+    const cd::spmatrixptr get_sparse_kernel() const;
+    /**
+     * \return true if the kernel matrix is stored as a sparse matrix
+     */
+    bool is_kernel_sparse() const;
     /**
      * \return m_grid.m_g
      */
-    const cd::matrixIptr get_grid() const;
+    const cd::pairlistptr get_grid() const;
     /**
      * \return m_grid.m_normh
      */
@@ -6,16 +6,30 @@
 namespace LocallyStationaryModels {
 using namespace cd;
 
+void Smt::build_anchor_kernel() const
+{
+    std::call_once(*m_kernel_built, [this]() { m_kernel.build_simple_kernel(m_anchorpos); });
+}
+
 double Smt::smooth_value(const size_t& pos, const size_t& n) const
 {
-    const matrix& K = *(m_kernel.get_kernel());
+    build_anchor_kernel();
 
     double numerator = 0;
     double denominator = 0;
 
-    for (size_t i = 0; i < m_anchorpos->rows(); ++i) {
-        numerator += K(pos, i) * m_solutions->operator()(i, n);
-        denominator += K(pos, i);
+    if (m_kernel.is_sparse()) {
+        // the kernel is symmetric, so the pos-th row is read as the pos-th column of the compressed matrix
+        for (spmatrix::InnerIterator it(*(m_kernel.get_sparse_kernel()), pos); it; ++it) {
+            numerator += it.value() * m_solutions->operator()(it.index(), n);
+            denominator += it.value();
+        }
+    } else {
+        const matrix& K = *(m_kernel.get_kernel());
+        for (size_t i = 0; i < m_anchorpos->rows(); ++i) {
+            numerator += K(pos, i) * m_solutions->operator()(i, n);
+            denominator += K(pos, i);
+        }
     }
     if (denominator < std::numeric_limits<double>::min()) {
         return 0;
@@ -23,14 +37,27 @@ double Smt::smooth_value(const size_t& pos, const size_t& n) const
     return numerator / denominator;
 }
 
-double Smt::smooth_value(const cd::vector& pos, const size_t& n) const
+double Smt::smooth_value(const cd::vector2& pos, const size_t& n) const
 {
     double numerator = 0;
     double denominator = 0;
 
-    for (size_t i = 0; i < m_anchorpos->rows(); ++i) {
-        numerator += m_kernel(pos, m_anchorpos->row(i)) * m_solutions->operator()(i, n);
-        denominator += m_kernel(pos, m_anchorpos->row(i));
+    if (m_index) {
+        // only the anchor points closer than m_radius are looked at
+        for (const size_t& i :
+            m_index->find_neighbours(pos[0], pos[1], m_radius * (1 + Tolerances::support_tolerance))) {
+            vector2 anchor = m_anchorpos->row(i);
+            double weight = m_kernel(pos, anchor);
+            numerator += weight * m_solutions->operator()(i, n);
+            denominator += weight;
+        }
+    } else {
+        for (size_t i = 0; i < m_anchorpos->rows(); ++i) {
+            vector2 anchor = m_anchorpos->row(i);
+            double weight = m_kernel(pos, anchor);
+            numerator += weight * m_solutions->operator()(i, n);
+            denominator += weight;
+        }
     }
     if (denominator < std::numeric_limits<double>::min()) {
         return 0;
@@ -38,49 +65,305 @@ double Smt::smooth_value(const cd::vector& pos, const size_t& n) const
     return numerator / denominator;
 }
 
-Smt::Smt(const cd::matrixptr& solutions, const matrixptr& anchorpos, const double& min_delta, const double& max_delta,
-    const std::string& kernel_id)
-    : m_anchorpos(anchorpos)
-    , m_solutions(solutions)
-    , m_kernel(kernel_id, min_delta)
+template <class Row>
+double Smt::smooth_truncated(const double& x, const double& y, vectorind& neighbours, Row&& result) const
 {
-    double min_error = std::numeric_limits<double>::infinity();
-    m_optimal_delta = (max_delta - min_delta) / 2;
-    const size_t n_deltas = Tolerances::n_deltas;
-    // find the optimal value of delta via cross-validation
-    for (size_t i = 0; i <= n_deltas; i++) {
-        double delta = min_delta + i * (max_delta - min_delta) / n_deltas;
-        // build a new kernel with bandwidth parameter equal to delta
-        m_kernel.build_simple_kernel(anchorpos, delta);
-        const matrix& Kk = *(m_kernel.get_kernel());
-
-        double error = 0;
-        // find the value of the error function for the current value of delta
-        #pragma omp parallel for reduction(+ : error)
-        for (size_t j = 0; j < m_anchorpos->rows(); ++j) {
-            cd::vector Kkrow = Kk.row(j);
-            double predicted_value = smooth_value(j, 3);
-            double real_value = m_solutions->operator()(j, 3);
-            double weightk2 = (1 - Kk(j, j) / Kkrow.sum()) * (1 - Kk(j, j) / Kkrow.sum());
+    // the radius is slightly enlarged, as when building a kernel matrix, since the index only returns the points
+    // strictly inside it while a kernel such as the identity is not zero on the boundary of its support
+    m_index->find_neighbours(x, y, m_radius * (1 + Tolerances::support_tolerance), neighbours);
+    const vector2 pos(x, y);
+
+    double denominator = 0;
+    result.setZero();
+    for (const size_t& i : neighbours) {
+        vector2 anchor = m_anchorpos->row(i);
+        double weight = m_kernel(pos, anchor);
+        result += weight * m_solutions->row(i);
+        denominator += weight;
+    }
+    // the kernel decreases with the distance, so the weight of each anchor point ignored is at most m_tail
+    double ignored = (m_anchorpos->rows() - neighbours.size()) * m_tail;
+    if (denominator < std::numeric_limits<double>::min()) {
+        result.setZero();
+        return ignored > 0 ? 1 : 0;
+    }
+    result /= denominator;
+    return ignored / (denominator + ignored);
+}
+
+matrix Smt::smooth_matrix(const matrix& positions, vector& truncation_error) const
+{
+    size_t M = positions.rows();
+    if (!m_index) {
+        truncation_error = vector::Zero(M);
+        return smooth_matrix(positions);
+    }
+
+    matrix result(M, m_solutions->cols());
+    truncation_error.resize(M);
+    #pragma omp parallel
+    {
+        vectorind neighbours;
+        #pragma omp for schedule(dynamic, 64)
+        for (size_t i = 0; i < M; ++i) {
+            truncation_error(i) = smooth_truncated(positions(i, 0), positions(i, 1), neighbours, result.row(i));
+        }
+    }
+    return result;
+}
+
+matrix Smt::smooth_matrix(const matrix& positions) const
+{
+    if (m_index) {
+        vector truncation_error;
+        return smooth_matrix(positions, truncation_error);
+    }
+
+    size_t M = positions.rows();
+    const size_t block = Tolerances::positions_per_block;
+    matrix result(M, m_solutions->cols());
+
+    #pragma omp parallel
+    {
+        matrix rows;
+        matrix W;
+        vector denominators;
+        #pragma omp for schedule(dynamic)
+        for (size_t i0 = 0; i0 < M; i0 += block) {
+            size_t B = std::min(block, M - i0);
+            // W contains the weights of every anchor point for the points of the block, so that the numerators of
+            // all the parameters are the product of W and the solutions
+            rows = positions.middleRows(i0, B);
+            m_kernel.evaluate(rows, *m_anchorpos, W);
+            denominators = W.rowwise().sum();
+            result.middleRows(i0, B).noalias() = W * *m_solutions;
+            for (size_t i = 0; i < B; ++i) {
+                if (denominators(i) < std::numeric_limits<double>::min()) {
+                    result.row(i0 + i).setZero();
+                } else {
+                    result.row(i0 + i) /= denominators(i);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+matrix Smt::smooth_raster(const double& x0, const double& y0, const double& dx, const double& dy, const size_t& nx,
+    const size_t& ny) const
+{
+    vector rasterx(nx);
+    for (size_t i = 0; i < nx; ++i) {
+        rasterx(i) = x0 + i * dx;
+    }
+    vector rastery(ny);
+    for (size_t j = 0; j < ny; ++j) {
+        rastery(j) = y0 + j * dy;
+    }
+
+    if (!m_kernel.is_separable()) {
+        matrix positions(nx * ny, 2);
+        for (size_t j = 0; j < ny; ++j) {
+            positions.middleRows(j * nx, nx).col(0) = rasterx;
+            positions.middleRows(j * nx, nx).col(1).setConstant(rastery(j));
+        }
+        return smooth_matrix(positions);
+    }
+
+    size_t N = m_anchorpos->rows();
+    size_t p = m_solutions->cols();
+
+    // the distinct x and y of the anchor points, which are few when the anchor points lie on a grid
+    auto distinct = [&](const size_t& c) {
+        std::vector<double> values(m_anchorpos->col(c).begin(), m_anchorpos->col(c).end());
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        return values;
+    };
+    const std::vector<double> linesx = distinct(0);
+    const std::vector<double> linesy = distinct(1);
+
+    // A[k] has in position (u, v) the sum of the k-th parameter of the anchor points with the u-th x and the v-th y,
+    // and A[p] their number, so that the numerators and the denominators of the whole raster are Gx * A[k] * Gy^T
+    std::vector<std::vector<Eigen::Triplet<double>>> triplets(p + 1);
+    for (size_t a = 0; a < N; ++a) {
+        size_t u = std::lower_bound(linesx.begin(), linesx.end(), m_anchorpos->operator()(a, 0)) - linesx.begin();
+        size_t v = std::lower_bound(linesy.begin(), linesy.end(), m_anchorpos->operator()(a, 1)) - linesy.begin();
+        for (size_t k = 0; k < p; ++k) {
+            triplets[k].emplace_back(u, v, m_solutions->operator()(a, k));
+        }
+        triplets[p].emplace_back(u, v, 1.);
+    }
+    std::vector<spmatrix> A(p + 1, spmatrix(linesx.size(), linesy.size()));
+    for (size_t k = 0; k <= p; ++k) {
+        A[k].setFromTriplets(triplets[k].begin(), triplets[k].end());
+    }
+
+    const vector vx = Eigen::Map<const vector>(linesx.data(), linesx.size());
+    const vector vy = Eigen::Map<const vector>(linesy.data(), linesy.size());
+    matrix Gy;
+    m_kernel.evaluate_separable(rastery, vy, Gy);
+
+    matrix result(nx * ny, p);
+    // the columns of the raster are processed in blocks, so that the memory needed does not depend on the number of
+    // anchor points times the number of nodes
+    const size_t block = Tolerances::positions_per_block;
+    #pragma omp parallel
+    {
+        matrix Gx;
+        matrix GxA;
+        matrix numerators;
+        matrix denominators;
+        #pragma omp for schedule(dynamic)
+        for (size_t i0 = 0; i0 < nx; i0 += block) {
+            size_t B = std::min(block, nx - i0);
+            m_kernel.evaluate_separable(rasterx.segment(i0, B), vx, Gx);
+            GxA = Gx * A[p];
+            denominators.noalias() = GxA * Gy.transpose();
+            for (size_t k = 0; k < p; ++k) {
+                GxA = Gx * A[k];
+                numerators.noalias() = GxA * Gy.transpose();
+                for (size_t j = 0; j < ny; ++j) {
+                    for (size_t i = 0; i < B; ++i) {
+                        double denominator = denominators(i, j);
+                        result(i0 + i + j * nx, k)
+                            = denominator < std::numeric_limits<double>::min() ? 0 : numerators(i, j) / denominator;
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+template <class KernelFunction>
+double Smt::cross_validation_error(const KernelFunction&, const matrix& squareddistances, const double& delta) const
+{
+    size_t N = squareddistances.cols();
+    const Eigen::ArrayXd sigma = m_solutions->col(3);
+    const double diagonal = KernelFunction::evaluate(0., delta);
+
+    double error = 0;
+    #pragma omp parallel reduction(+ : error)
+    {
+        Eigen::ArrayXd weights(N);
+        // the kernel is symmetric, so the j-th row of the kernel matrix is computed as the j-th column of the squared
+        // distances with a single vectorised evaluation of the kernel function
+        #pragma omp for schedule(static)
+        for (size_t j = 0; j < N; ++j) {
+            weights = KernelFunction::evaluate(squareddistances.col(j).array(), delta);
+            double rowsum = weights.sum();
+            double predicted_value = rowsum < std::numeric_limits<double>::min() ? 0 : (weights * sigma).sum() / rowsum;
+            double real_value = sigma(j);
+            double weightk2 = (1 - diagonal / rowsum) * (1 - diagonal / rowsum);
 
             error += (real_value - predicted_value) * (real_value - predicted_value) / weightk2;
         }
+    }
+    // an anchor point with no neighbours inside the support of the kernel cannot be predicted by the others
+    return std::isfinite(error) ? error : std::numeric_limits<double>::infinity();
+}
+
+template <class KernelFunction>
+void Smt::find_optimal_delta(const KernelFunction& f, const double& min_delta, const double& max_delta)
+{
+    size_t N = m_anchorpos->rows();
+    const Eigen::ArrayXd cx = m_anchorpos->col(0);
+    const Eigen::ArrayXd cy = m_anchorpos->col(1);
+
+    // the squared distances between the anchor points do not depend on delta, so they are computed only once and
+    // each candidate delta only costs a rescaling of them through the kernel function
+    matrix squareddistances(N, N);
+    #pragma omp parallel for
+    for (size_t j = 0; j < N; ++j) {
+        squareddistances.col(j).array() = (cx - cx(j)).square() + (cy - cy(j)).square();
+    }
+
+    double min_error = std::numeric_limits<double>::infinity();
+    m_optimal_delta = (max_delta - min_delta) / 2;
+    auto update = [&](const double& delta, const double& error) {
         if (error < min_error) {
             m_optimal_delta = delta;
             min_error = error;
         }
+    };
+
+    // evaluate the error on a coarse grid of deltas to bracket its minimum
+    const size_t n_deltas = Tolerances::n_deltas;
+    const double step = (max_delta - min_delta) / n_deltas;
+    size_t best = 0;
+    for (size_t i = 0; i <= n_deltas; ++i) {
+        double error = cross_validation_error(f, squareddistances, min_delta + i * step);
+        best = error < min_error ? i : best;
+        update(min_delta + i * step, error);
+    }
+
+    // refine the minimum with a golden-section search between the two neighbours of the best delta of the grid
+    const double ratio = (std::sqrt(5.) - 1) / 2;
+    double a = min_delta + (best > 0 ? best - 1 : 0) * step;
+    double b = min_delta + std::min(best + 1, n_deltas) * step;
+    double c = b - ratio * (b - a);
+    double d = a + ratio * (b - a);
+    double fc = cross_validation_error(f, squareddistances, c);
+    double fd = cross_validation_error(f, squareddistances, d);
+    while (b - a > Tolerances::delta_tolerance * (max_delta - min_delta)) {
+        if (fc <= fd) {
+            b = d;
+            d = c;
+            fd = fc;
+            c = b - ratio * (b - a);
+            fc = cross_validation_error(f, squareddistances, c);
+        } else {
+            a = c;
+            c = d;
+            fc = fd;
+            d = a + ratio * (b - a);
+            fd = cross_validation_error(f, squareddistances, d);
+        }
     }
-    // build the final kernel with the optimal value of delta
-    m_kernel.build_simple_kernel(m_anchorpos, m_optimal_delta);
+    update(c, fc);
+    update(d, fd);
 }
 
-Smt::Smt(const cd::matrixptr& solutions, const matrixptr& anchorpos, const double delta, const std::string& kernel_id)
+Smt::Smt(const cd::matrixptr& solutions, const matrixptr& anchorpos, const double& min_delta, const double& max_delta,
+    const std::string& kernel_id)
+    : m_anchorpos(anchorpos)
+    , m_solutions(solutions)
+    , m_kernel(kernel_id, min_delta)
+{
+    // find the optimal value of delta via cross-validation, with the loops compiled for the chosen kernel function
+    std::visit([&](const auto& f) { find_optimal_delta(f, min_delta, max_delta); }, kf::make_kernel(kernel_id));
+    // use the optimal value of delta from now on, the kernel matrix between the anchor points is built only if the
+    // smoothed values in the anchor points are requested
+    m_kernel = Kernel(kernel_id, m_optimal_delta);
+    build_index(0);
+}
+
+Smt::Smt(const cd::matrixptr& solutions, const matrixptr& anchorpos, const double delta, const std::string& kernel_id,
+    const double& truncation)
     : m_anchorpos(anchorpos)
     , m_solutions(solutions)
     , m_kernel(kernel_id, delta)
     , m_optimal_delta(delta)
 {
-    m_kernel.build_simple_kernel(m_anchorpos);
+    build_index(truncation);
+}
+
+Smt::Smt(const cd::matrixptr& solutions, const matrixptr& anchorpos, const double delta, const std::string& kernel_id)
+    : Smt(solutions, anchorpos, delta, kernel_id, 0.) {};
+
+void Smt::build_index(const double& truncation)
+{
+    double support = m_kernel.support();
+    m_radius = truncation > 0 ? std::min(support, truncation * m_optimal_delta) : support;
+    if (!std::isfinite(m_radius)) {
+        return;
+    }
+    // the anchor points outside the support of the kernel have weight zero, so only a shorter radius drops some mass
+    if (m_radius < support) {
+        m_tail = m_kernel(vector2::Zero(), vector2(m_radius, 0));
+    }
+    m_index = std::make_shared<const SpatialIndex>(m_anchorpos, m_radius);
 }
 
 const cd::matrixptr Smt::get_solutions() const { return m_solutions; }
@@ -17,10 +17,42 @@ private:
     cd::matrixptr m_solutions = nullptr; ///< matrix wiht the solution of the optimization
     cd::matrixptr m_anchorpos = nullptr; ///< anchor points
 
-    Kernel m_kernel; ///< kernel
+    mutable Kernel m_kernel; ///< kernel, whose matrix between the anchor points is built only when first needed
+    /// flag set once the kernel matrix between the anchor points has been built, shared with the copies of the
+    /// smoother since they also share the matrix
+    std::shared_ptr<std::once_flag> m_kernel_built = std::make_shared<std::once_flag>();
 
     double m_optimal_delta = 0; ///< optimal value for delta
 
+    /// radius outside which the anchor points are ignored when smoothing in a position, infinite to use all of them
+    double m_radius = std::numeric_limits<double>::infinity();
+    double m_tail = 0; ///< largest kernel weight of an anchor point ignored because it is farther than m_radius
+    std::shared_ptr<const SpatialIndex> m_index = nullptr; ///< index of the anchor points, built if m_radius is finite
+
+    /**
+     * \brief set m_radius to the support of the kernel, or to truncation times delta if smaller, and index the anchor
+     * points if the radius is finite
+     * \param truncation the multiple of delta outside which the anchor points are ignored, 0 for no truncation
+     */
+    void build_index(const double& truncation);
+
+    /**
+     * \brief smooth all the parameters for a point looking only at the anchor points closer than m_radius
+     * \param x the x of the point
+     * \param y the y of the point
+     * \param neighbours a vector used to store the anchor points found, to avoid allocating memory at each call
+     * \param result a row overwritten with the smoothed parameters
+     * \return an upper bound of the fraction of the kernel weight of the anchor points ignored
+     */
+    template <class Row>
+    double smooth_truncated(const double& x, const double& y, cd::vectorind& neighbours, Row&& result) const;
+
+    /**
+     * \brief build the kernel matrix between the anchor points the first time it is called, which may happen
+     * concurrently from several threads
+     */
+    void build_anchor_kernel() const;
+
     /**
      * \brief smooth a single parameter for a point in position pos
      * \param pos the index of the position of the point where to find the smoothed value of the parameter
@@ -29,12 +61,34 @@ private:
     double smooth_value(const size_t& pos, const size_t& n) const;
 
     /**
-     * \brief smooth a single parameter for a point in position pos
+     * \brief smooth a single parameter for a point in position pos. With a truncation the anchor points farther than
+     * m_radius are ignored without reporting the error, whose bound is only returned by smooth_matrix
      * \param pos a vector with the coordinates of the position of the point where to find the smoothed value of the
-     * parameter 
+     * parameter
      * \param n the index of the parameter to obtain
      */
-    double smooth_value(const cd::vector& pos, const size_t& n) const;
+    double smooth_value(const cd::vector2& pos, const size_t& n) const;
+
+    /**
+     * \brief compute the leave-one-out cross-validation error of the smoothing of sigma for a given delta
+     * \param f the kernel function, only used to select the type the loops are compiled for
+     * \param squareddistances the squared distances between every pair of anchor points
+     * \param delta the bandwidth parameter
+     * \return the cross-validation error, infinity if it cannot be computed
+     */
+    template <class KernelFunction>
+    double cross_validation_error(
+        const KernelFunction& f, const cd::matrix& squareddistances, const double& delta) const;
+
+    /**
+     * \brief find the delta between min_delta and max_delta minimizing the cross-validation error and store it in
+     * m_optimal_delta
+     * \param f the kernel function, only used to select the type the loops are compiled for
+     * \param min_delta the minimum value of delta
+     * \param max_delta the maximum value of delta
+     */
+    template <class KernelFunction>
+    void find_optimal_delta(const KernelFunction& f, const double& min_delta, const double& max_delta);
 
 public:
     /**
@@ -57,13 +111,25 @@ public:
      */
     Smt(const cd::matrixptr& solutions, const cd::matrixptr& anchorpos, const double delta,
         const std::string& kernel_id);
+    /**
+     * \brief constructor
+     * \param solutions a shared pointer to the solutions of the optimization
+     * \param anchorpos a vector containing the indeces of the anchor position obtained by clustering
+     * \param delta a user-chosen value for delta
+     * \param truncation when smoothing in a position ignore the anchor points farther than truncation times delta,
+     * found with a spatial index so that the cost does not depend on the total number of anchor points. 0 for no
+     * truncation, in which case only kernels with compact support use the index
+     */
+    Smt(const cd::matrixptr& solutions, const cd::matrixptr& anchorpos, const double delta,
+        const std::string& kernel_id, const double& truncation);
     /**
      * \brief constructor. Call the default constructor for m_kernel
      */
     Smt();
 
     /**
-     * \brief smooth all the parameters for a point in position pos
+     * \brief smooth all the parameters for a point in position pos. A position given by its coordinates is truncated
+     * as in smooth_matrix, but without the bound of the error
      * \param pos a vector of coordinates or the index of the position of the point where to find the smoothed value of
      * the parameters
      */
@@ -76,6 +142,40 @@ public:
         return result;
     };
 
+    /**
+     * \brief smooth all the parameters for many points at once. The weights of a block of points are computed once
+     * and applied to all the parameters with a single matrix product
+     * \param positions a matrix with the coordinates of a point in each row
+     * \return a matrix with the smoothed parameters of the point in the i-th row of positions in its i-th row
+     */
+    cd::matrix smooth_matrix(const cd::matrix& positions) const;
+
+    /**
+     * \brief smooth all the parameters for many points at once
+     * \param positions a matrix with the coordinates of a point in each row
+     * \param truncation_error overwritten with an upper bound of the fraction of the kernel weight ignored in each
+     * point because of the truncation. The error on each smoothed parameter is at most this fraction times the range
+     * of the values of that parameter in the anchor points
+     * \return a matrix with the smoothed parameters of the point in the i-th row of positions in its i-th row
+     */
+    cd::matrix smooth_matrix(const cd::matrix& positions, cd::vector& truncation_error) const;
+
+    /**
+     * \brief smooth all the parameters on the nodes (x0 + i * dx, y0 + j * dy) of a regular raster. With a separable
+     * kernel the weights are the product of an nx x (distinct x of the anchor points) and a (distinct y of the anchor
+     * points) x ny matrix, so that neither the kernel nor the weights of all the nodes for all the anchor points are
+     * ever computed; otherwise the nodes are smoothed as any other set of points
+     * \param x0 the x of the first column of the raster
+     * \param y0 the y of the first row of the raster
+     * \param dx the distance between two columns of the raster
+     * \param dy the distance between two rows of the raster
+     * \param nx the number of columns of the raster
+     * \param ny the number of rows of the raster
+     * \return a matrix with the smoothed parameters of the node (x0 + i * dx, y0 + j * dy) in its row i + j * nx
+     */
+    cd::matrix smooth_raster(const double& x0, const double& y0, const double& dx, const double& dy, const size_t& nx,
+        const size_t& ny) const;
+
     /**
      * \return a shared pointer to the solutions found by the optimizer
      */
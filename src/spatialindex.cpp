@@ -0,0 +1,98 @@
+// Copyright (C) Luca Crippa <luca7.crippa@mail.polimi.it>
+// Copyright (C) Giacomo De Carlo <giacomo.decarlo@mail.polimi.it>
+
+#include "spatialindex.hpp"
+
+namespace LocallyStationaryModels {
+using namespace cd;
+
+SpatialIndex::SpatialIndex(const matrixptr& coordinates, const double& cell_size)
+    : m_coordinates(coordinates)
+    , m_cell_size(cell_size)
+{
+    const matrix& c = *(m_coordinates);
+    size_t n = c.rows();
+    if (n == 0) {
+        m_cellstart.assign(1, 0);
+        return;
+    }
+
+    m_origin_x = c.col(0).minCoeff();
+    m_origin_y = c.col(1).minCoeff();
+    double width = c.col(0).maxCoeff() - m_origin_x;
+    double height = c.col(1).maxCoeff() - m_origin_y;
+    if (!(m_cell_size > 0)) {
+        m_cell_size = std::max(std::max(width, height), 1.);
+    }
+    m_nx = static_cast<size_t>(width / m_cell_size) + 1;
+    m_ny = static_cast<size_t>(height / m_cell_size) + 1;
+    // avoid allocating far more buckets than points when the domain is much larger than the requested cell size
+    while (m_nx * m_ny > 4 * n + 16) {
+        m_cell_size *= 2;
+        m_nx = static_cast<size_t>(width / m_cell_size) + 1;
+        m_ny = static_cast<size_t>(height / m_cell_size) + 1;
+    }
+
+    // counting sort of the points by bucket, which keeps them sorted by index inside each bucket
+    vectorind cells(n);
+    m_cellstart.assign(m_nx * m_ny + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+        size_t ix = std::min(static_cast<size_t>((c(i, 0) - m_origin_x) / m_cell_size), m_nx - 1);
+        size_t iy = std::min(static_cast<size_t>((c(i, 1) - m_origin_y) / m_cell_size), m_ny - 1);
+        cells[i] = ix + m_nx * iy;
+        m_cellstart[cells[i] + 1]++;
+    }
+    for (size_t k = 0; k < m_nx * m_ny; ++k) {
+        m_cellstart[k + 1] += m_cellstart[k];
+    }
+    m_points.resize(n);
+    vectorind next(m_cellstart.begin(), m_cellstart.end() - 1);
+    for (size_t i = 0; i < n; ++i) {
+        m_points[next[cells[i]]++] = i;
+    }
+}
+
+void SpatialIndex::find_neighbours(const double& x, const double& y, const double& radius, vectorind& neighbours) const
+{
+    neighbours.clear();
+    if (m_points.empty()) {
+        return;
+    }
+    const matrix& c = *(m_coordinates);
+
+    // range of buckets overlapping the square circumscribed to the neighbourhood
+    double fx0 = std::floor((x - radius - m_origin_x) / m_cell_size);
+    double fx1 = std::floor((x + radius - m_origin_x) / m_cell_size);
+    double fy0 = std::floor((y - radius - m_origin_y) / m_cell_size);
+    double fy1 = std::floor((y + radius - m_origin_y) / m_cell_size);
+    if (fx1 < 0 || fy1 < 0 || fx0 >= m_nx || fy0 >= m_ny) {
+        return;
+    }
+    size_t ix0 = fx0 < 0 ? 0 : static_cast<size_t>(fx0);
+    size_t iy0 = fy0 < 0 ? 0 : static_cast<size_t>(fy0);
+    size_t ix1 = std::min(static_cast<size_t>(fx1), m_nx - 1);
+    size_t iy1 = std::min(static_cast<size_t>(fy1), m_ny - 1);
+
+    for (size_t iy = iy0; iy <= iy1; ++iy) {
+        for (size_t ix = ix0; ix <= ix1; ++ix) {
+            size_t k = ix + m_nx * iy;
+            for (size_t p = m_cellstart[k]; p < m_cellstart[k + 1]; ++p) {
+                size_t j = m_points[p];
+                double deltax = c(j, 0) - x;
+                double deltay = c(j, 1) - y;
+                if (std::sqrt(deltax * deltax + deltay * deltay) < radius) {
+                    neighbours.push_back(j);
+                }
+            }
+        }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+}
+
+vectorind SpatialIndex::find_neighbours(const double& x, const double& y, const double& radius) const
+{
+    vectorind neighbours;
+    find_neighbours(x, y, radius, neighbours);
+    return neighbours;
+}
+} // namespace LocallyStationaryModels
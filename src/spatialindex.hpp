@@ -0,0 +1,50 @@
+// Copyright (C) Luca Crippa <luca7.crippa@mail.polimi.it>
+// Copyright (C) Giacomo De Carlo <giacomo.decarlo@mail.polimi.it>
+
+#ifndef LOCALLY_STATIONARY_MODELS_SPATIAL_INDEX
+#define LOCALLY_STATIONARY_MODELS_SPATIAL_INDEX
+
+#include "traits.hpp"
+
+namespace LocallyStationaryModels {
+/**
+ * \brief a uniform grid of square buckets covering a set of points, used to find all the points closer than a given
+ * radius to a position without looking at every point of the set
+ */
+class SpatialIndex {
+private:
+    cd::matrixptr m_coordinates = nullptr; ///< coordinates of the indexed points
+    double m_origin_x = 0; ///< x of the lower left corner of the buckets
+    double m_origin_y = 0; ///< y of the lower left corner of the buckets
+    double m_cell_size = 1; ///< side of each bucket
+    size_t m_nx = 0; ///< number of buckets per row
+    size_t m_ny = 0; ///< number of buckets per column
+    cd::vectorind m_cellstart; ///< position in m_points of the first point of each bucket, of size m_nx * m_ny + 1
+    cd::vectorind m_points; ///< indices of the points sorted by bucket (and by index inside each bucket)
+
+public:
+    /**
+     * \brief constructor
+     * \param coordinates a shared pointer to the matrix with the coordinates of the points to index
+     * \param cell_size the side of the buckets, usually the largest radius the index is going to be queried with. It
+     * is enlarged when needed so that the number of buckets does not exceed a few times the number of points
+     */
+    SpatialIndex(const cd::matrixptr& coordinates, const double& cell_size);
+
+    /**
+     * \brief find the points whose distance from (x, y) is strictly less than radius
+     * \param x the x of the center of the neighbourhood
+     * \param y the y of the center of the neighbourhood
+     * \param radius the radius of the neighbourhood
+     * \param neighbours a vector overwritten with the indices of the points found, sorted in increasing order
+     */
+    void find_neighbours(const double& x, const double& y, const double& radius, cd::vectorind& neighbours) const;
+
+    /**
+     * \return the indices of the points whose distance from (x, y) is strictly less than radius
+     */
+    cd::vectorind find_neighbours(const double& x, const double& y, const double& radius) const;
+}; // class SpatialIndex
+} // namespace LocallyStationaryModels
+
+#endif // LOCALLY_STATIONARY_MODELS_SPATIAL_INDEX
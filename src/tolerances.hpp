@@ -17,14 +17,45 @@ struct Tolerances {
     static constexpr double min_determinant = 1e-12;
     /// optimization termination condition parameter epsilon
     static constexpr double param_epsilon = 1e-6;
+    /// optimization termination condition parameter epsilon_rel of the Levenberg-Marquardt solver. The ranges are
+    /// hundreds of times larger than the gradient of the wls, so a tolerance relative to the norm of the parameters
+    /// would stop it at once
+    static constexpr double param_epsilon_rel = 0;
     /// optimization termination condition parameter max_iterations
     static constexpr double param_max_iterations = 1000000;
     /// minimun threshold below which the norm of a vector is considered to be 0
     static constexpr double min_norm = 1e-12;
     /// huge value to be considered as infinite when returning inf would cause troubles
     static constexpr double infinity = 1e12;
-    /// number of delta between min_delta and max_delta to perform cross-validation
-    static constexpr double n_deltas = 1000;
+    /// number of intervals of the grid between min_delta and max_delta used to bracket the optimal delta
+    static constexpr size_t n_deltas = 32;
+    /// width, relative to max_delta - min_delta, below which the search of the optimal delta stops
+    static constexpr double delta_tolerance = 1e-4;
+    /// number of points whose parameters are smoothed together with a single matrix product
+    static constexpr size_t positions_per_block = 256;
+    /// number of anchor points whose sample variogram is accumulated together in a single pass over the pairs
+    static constexpr size_t anchors_per_block = 64;
+    /// relative enlargement of the radius used to find the points inside the support of a compact kernel
+    static constexpr double support_tolerance = 1e-9;
+    /// distance between two nodes of the table of the Matern correlation
+    static constexpr double matern_table_step = 0.02;
+    /// maximum interpolation error of the table of the Matern correlation, the intervals above it are computed exactly
+    static constexpr double matern_table_tolerance = 1e-9;
+    /// maximum number of nodes of the table of the Matern correlation
+    static constexpr size_t matern_table_max_nodes = 100000;
+    /// minimum number of evaluations with the same nu above which the Matern correlation is tabulated
+    static constexpr size_t matern_table_min_evaluations = 50000;
+    /// argument of the Matern correlation above which it is taken as 0: it has underflowed for any nu for which
+    /// std::tgamma(nu) is finite, while std::cyl_bessel_k throws std::runtime_error from about 1e6
+    static constexpr double matern_max_argument = 1e4;
+    /// initial damping of the Levenberg-Marquardt solver, relative to the diagonal of the Gauss-Newton matrix
+    static constexpr double lm_initial_damping = 1e-3;
+    /// damping above which the Levenberg-Marquardt solver gives up looking for a better point
+    static constexpr double lm_max_damping = 1e16;
+    /// minimum diagonal scaling of the Levenberg-Marquardt damping, relative to the largest one
+    static constexpr double lm_scaling_floor = 1e-12;
+    /// relative norm of the step below which the Levenberg-Marquardt solver stops
+    static constexpr double lm_step_tolerance = 1e-10;
     /// step for the numerical computation of the gradient
     static constexpr double gradient_step = 10e-8;
 }; // struct Tolerances
@@ -10,11 +10,14 @@
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <omp.h>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "Eigen/Dense"
+#include "Eigen/Sparse"
 #include "tolerances.hpp"
 
 namespace LocallyStationaryModels {
@@ -25,16 +28,32 @@ namespace LocallyStationaryModels {
 namespace cd {
     // defining basic types
     using vector = Eigen::VectorXd;
+    using vector2 = Eigen::Vector2d;
     using matrix = Eigen::MatrixXd;
     using matrixI = Eigen::MatrixXi;
+    using vectorI = Eigen::VectorXi;
+    using spmatrix = Eigen::SparseMatrix<double>;
     using vectorptr = std::shared_ptr<vector>;
     using matrixptr = std::shared_ptr<matrix>;
     using matrixIptr = std::shared_ptr<matrixI>;
+    using vectorIptr = std::shared_ptr<vectorI>;
+    using spmatrixptr = std::shared_ptr<spmatrix>;
     using vectorind = std::vector<size_t>;
 
+    /**
+     * \brief compact storage of the pairs of points (i, j), with i < j, whose lag falls inside the grid, in compressed
+     * row format: the pairs whose first point is i are stored in the positions from rowstart[i] to rowstart[i + 1] - 1
+     * of second and cell
+     */
+    struct pairlist {
+        vectorind rowstart; ///< position of the first pair of each row, its size is the number of points plus one
+        vectorind second; ///< index j of the second point of each pair
+        vectorind cell; ///< index of the cell of the grid each pair belongs to
+    };
+    using pairlistptr = std::shared_ptr<pairlist>;
+
     // defining function types
-    using kernelfunction = std::function<double(const vector&, const vector&, const double&)>;
-    using gridfunction = std::function<matrixIptr(const matrixptr&, const size_t&, const size_t&, const double&)>;
+    using gridfunction = std::function<pairlistptr(const matrixptr&, const size_t&, const size_t&, const double&)>;
 
 } // namespace cd
 } // namespace LocallyStationaryModels
@@ -3,117 +3,420 @@
 
 #include "variogramfit.hpp"
 
+#include <numeric>
+
 namespace LocallyStationaryModels {
 using namespace cd;
 using namespace LBFGSpp;
 
-double TargetFunction::operator()(const cd::vector& params)
+PackedBins::PackedBins(const cd::matrixptr& empiricvariogram, const cd::matrixptr& squaredweights,
+    const cd::vectorptr& mean_x, const cd::vectorptr& mean_y)
 {
-    VariogramFunction& gammaiso = *(m_gammaisoptr);
-    vector w = m_squaredweights->row(m_x0);
-    vector truegamma(m_empiricvariogram->rows());
+    const matrix& sw = *(squaredweights);
+    size_t N = sw.rows();
+    size_t H = sw.cols();
+
+    // count the cells with non-zero weight of each anchor point walking the squared weights column by column, which is
+    // the order they are stored in
+    start.assign(N + 1, 0);
+    for (size_t h = 0; h < H; ++h) {
+        for (size_t l = 0; l < N; ++l) {
+            if (sw(l, h) != 0) {
+                start[l + 1]++;
+            }
+        }
+    }
+    for (size_t l = 0; l < N; ++l) {
+        start[l + 1] += start[l];
+    }
 
-    for (size_t h = 0; h < truegamma.size(); ++h) {
-        truegamma[h] = gammaiso(params, m_mean_x->operator[](h), m_mean_y->operator[](h));
+    w.resize(start[N]);
+    gamma.resize(start[N]);
+    x.resize(start[N]);
+    y.resize(start[N]);
+    vectorind next(start.begin(), start.end() - 1);
+    for (size_t h = 0; h < H; ++h) {
+        for (size_t l = 0; l < N; ++l) {
+            if (sw(l, h) != 0) {
+                size_t p = next[l]++;
+                w[p] = sw(l, h);
+                gamma[p] = empiricvariogram->operator()(h, l);
+                x[p] = mean_x->operator[](h);
+                y[p] = mean_y->operator[](h);
+            }
+        }
     }
-    vector empiricgamma = m_empiricvariogram->col(m_x0);
-    return w.dot((truegamma - empiricgamma).cwiseProduct(truegamma - empiricgamma));
 }
 
-double TargetFunction::operator()(const cd::vector& params, vector& grad)
+template <class Variogram> void TargetFunction<Variogram>::check_budget()
 {
-    VariogramFunction& gammaiso = *(m_gammaisoptr);
-    vector w = m_squaredweights->row(m_x0);
-    vector truegamma(m_empiricvariogram->rows());
+    if (m_max_evaluations > 0 && m_evaluations >= m_max_evaluations) {
+        throw BudgetExceeded(FitStatus::evaluation_budget);
+    }
+    if (omp_get_wtime() > m_deadline) {
+        throw BudgetExceeded(FitStatus::deadline);
+    }
+}
 
-    for (size_t h = 0; h < truegamma.size(); ++h) {
-        truegamma[h] = gammaiso(params, m_mean_x->operator[](h), m_mean_y->operator[](h));
+template <class Variogram> void TargetFunction<Variogram>::record(const cd::vector& params, const double& value)
+{
+    m_evaluations++;
+    if (value < m_best) {
+        m_best = value;
+        m_bestparams = params;
     }
+}
 
-    // we update the gradient of the function
-    // partial derivative are calcutated with central differences method
-    // the step for the numerical estimation of the gradient is chosen proportionally to the parameter with respect to
-    // which we are calculating the derivative
-    for (size_t i = 0; i < params.size(); ++i) {
-        vector paramsdeltaplus(params);
-        vector paramsdeltaminus(params);
+template <class Variogram> double TargetFunction<Variogram>::operator()(const cd::vector& params)
+{
+    check_budget();
+    // the anisotropy transform is computed once for all the cells
+    m_gammaiso.set_params(params);
+    const PackedBins& bins = *(m_bins);
+    double value = 0;
 
-        double increment = Tolerances::gradient_step * params[i];
+    for (size_t p = m_begin; p < m_end; ++p) {
+        double residual = m_gammaiso(bins.x[p], bins.y[p]) - bins.gamma[p];
+        value += bins.w[p] * residual * residual;
+    }
+    record(params, value);
+    return value;
+}
 
-        paramsdeltaplus[i] += increment;
-        paramsdeltaminus[i] -= increment;
+template <class Variogram> double TargetFunction<Variogram>::operator()(const cd::vector& params, vector& grad)
+{
+    check_budget();
+    m_gammaiso.set_params(params);
+    const PackedBins& bins = *(m_bins);
+    double value = 0;
+    grad.setZero();
 
-        grad[i] = (TargetFunction::operator()(paramsdeltaplus) - TargetFunction::operator()(paramsdeltaminus))
-            / (2 * increment);
+    // the objective and its gradient are accumulated in the same pass over the cells of the grid, using the partial
+    // derivatives of the variogram with respect to the parameters
+    for (size_t p = m_begin; p < m_end; ++p) {
+        double residual = m_gammaiso.gradient(bins.x[p], bins.y[p], m_dgamma) - bins.gamma[p];
+        value += bins.w[p] * residual * residual;
+        grad += (2 * bins.w[p] * residual) * m_dgamma;
     }
+    m_gradient_evaluations++;
+    record(params, value);
+    return value;
+}
 
-    vector empiricgamma = m_empiricvariogram->col(m_x0);
-    return w.dot((truegamma - empiricgamma).cwiseProduct(truegamma - empiricgamma));
+template <class Variogram>
+double TargetFunction<Variogram>::normal_equations(const cd::vector& params, matrix& JtJ, vector& Jtr)
+{
+    check_budget();
+    m_gammaiso.set_params(params);
+    const PackedBins& bins = *(m_bins);
+    double value = 0;
+    JtJ.setZero();
+    Jtr.setZero();
+
+    // the jacobian is never stored: the row of each cell, sqrt(w) times the gradient of the variogram, is added to the
+    // normal equations as soon as it is computed
+    for (size_t p = m_begin; p < m_end; ++p) {
+        double residual = m_gammaiso.gradient(bins.x[p], bins.y[p], m_dgamma) - bins.gamma[p];
+        value += bins.w[p] * residual * residual;
+        JtJ.selfadjointView<Eigen::Lower>().rankUpdate(m_dgamma, bins.w[p]);
+        Jtr += (bins.w[p] * residual) * m_dgamma;
+    }
+    JtJ.triangularView<Eigen::StrictlyUpper>() = JtJ.transpose();
+    m_gradient_evaluations++;
+    record(params, value);
+    return value;
 }
 
-TargetFunction::TargetFunction(const cd::matrixptr& empiricvariogram, const cd::matrixptr& squaredweights,
-    const cd::vectorptr& mean_x, const cd::vectorptr& mean_y, const size_t& x0, const std::string& id)
-    : m_empiricvariogram(empiricvariogram)
-    , m_squaredweights(squaredweights)
-    , m_mean_x(mean_x)
-    , m_mean_y(mean_y)
-    , m_x0(x0)
-    , m_gammaisoptr(make_variogramiso(id)) {};
+template <class Variogram>
+TargetFunction<Variogram>::TargetFunction(const std::shared_ptr<const PackedBins>& bins, const size_t& x0,
+    const Variogram& gammaiso, const size_t& n_params)
+    : m_bins(bins)
+    , m_begin(bins->start[x0])
+    , m_end(bins->start[x0 + 1])
+    , m_gammaiso(gammaiso)
+    , m_dgamma(n_params) {};
+
+template <class Variogram> void TargetFunction<Variogram>::set_anchor(const size_t& x0)
+{
+    m_begin = m_bins->start[x0];
+    m_end = m_bins->start[x0 + 1];
+}
+
+template <class Variogram>
+void TargetFunction<Variogram>::set_budget(const size_t& max_evaluations, const double& deadline)
+{
+    m_evaluations = 0;
+    m_gradient_evaluations = 0;
+    m_max_evaluations = max_evaluations;
+    m_deadline = deadline;
+    m_best = std::numeric_limits<double>::infinity();
+}
+
+template <class Variogram>
+OptWorkspace<Variogram>::OptWorkspace(const std::shared_ptr<const PackedBins>& bins, const Variogram& gammaiso,
+    const size_t& n_params, const size_t& max_iterations)
+    : m_param()
+    , m_lbfgsb(m_param)
+    , m_lm(Tolerances::param_epsilon, Tolerances::param_epsilon_rel, max_iterations)
+    , m_fun(bins, 0, gammaiso, n_params)
+    , m_x(n_params)
+    , m_start(n_params)
+{
+    // m_lbfgsb holds a reference to m_param, hence it sees the values set here
+    m_param.epsilon = Tolerances::param_epsilon;
+    m_param.max_iterations = max_iterations;
+};
 
 Opt::Opt(const cd::matrixptr& empiricvariogram, const cd::matrixptr& squaredweights, const cd::vectorptr& mean_x,
     const cd::vectorptr& mean_y, const std::string& id, const cd::vector& initialparameters,
-    const cd::vector& lowerbound, const cd::vector& upperbound)
+    const cd::vector& lowerbound, const cd::vector& upperbound, const std::string& solver)
     : m_empiricvariogram(empiricvariogram)
     , m_squaredweights(squaredweights)
     , m_mean_x(mean_x)
     , m_mean_y(mean_y)
     , m_id(id)
+    , m_gammaiso(make_variogramiso(id))
     , m_initialparameters(initialparameters)
     , m_lowerbound(lowerbound)
     , m_upperbound(upperbound)
+    , m_solver(solver)
 {
     m_solutions = std::make_shared<matrix>(matrix::Zero(m_empiricvariogram->cols(), m_initialparameters.size()));
+    m_iterations = std::make_shared<vector>(vector::Zero(m_empiricvariogram->cols()));
+    m_times = std::make_shared<vector>(vector::Zero(m_empiricvariogram->cols()));
+    m_busytimes = std::make_shared<vector>();
+    m_status = std::make_shared<vectorI>(vectorI::Zero(m_empiricvariogram->cols()));
+    m_evaluations = std::make_shared<vector>(vector::Zero(m_empiricvariogram->cols()));
+    m_gradient_evaluations = std::make_shared<vector>(vector::Zero(m_empiricvariogram->cols()));
+    m_objective = std::make_shared<vector>(vector::Zero(m_empiricvariogram->cols()));
+    m_bins = std::make_shared<const PackedBins>(m_empiricvariogram, m_squaredweights, m_mean_x, m_mean_y);
 };
 
-vector Opt::findonesolution(const size_t& pos) const
-{
-    TargetFunction fun(m_empiricvariogram, m_squaredweights, m_mean_x, m_mean_y, pos, m_id);
-
-    // Set up parameters
-    LBFGSBParam<double> param;
-    param.epsilon = Tolerances::param_epsilon;
-    param.max_iterations = Tolerances::param_max_iterations;
+Opt::Opt(const cd::matrixptr& empiricvariogram, const cd::matrixptr& squaredweights, const cd::vectorptr& mean_x,
+    const cd::vectorptr& mean_y, const std::string& id, const cd::vector& initialparameters,
+    const cd::vector& lowerbound, const cd::vector& upperbound)
+    : Opt(empiricvariogram, squaredweights, mean_x, mean_y, id, initialparameters, lowerbound, upperbound, "lbfgsb") {};
 
-    // Create solver and function object
-    LBFGSBSolver<double> solver(param);
+template <class Variogram>
+void Opt::findonesolution(OptWorkspace<Variogram>& workspace, const size_t& pos)
+{
+    const cd::vector& start = workspace.m_start;
+    double begin = omp_get_wtime();
+    TargetFunction<Variogram>& fun = workspace.m_fun;
+    fun.set_anchor(pos);
 
-    // Bounds
-    Eigen::VectorXd lb(m_lowerbound);
-    Eigen::VectorXd ub(m_upperbound);
+    fun.set_budget(m_max_evaluations, m_deadline);
 
-    cd::vector x(m_initialparameters);
+    cd::vector& x = workspace.m_x;
+    x = m_initialparameters;
     // x will be overwritten to be the best point found
-    double fx;
+    double fx = std::numeric_limits<double>::quiet_NaN();
 
+    size_t iterations = 0;
+    // set once the optimizer has started, so that an exception thrown by the comparison with the warm start does not
+    // report the iterations of the previous anchor point solved by this workspace
+    bool started = false;
+    FitStatus status = FitStatus::converged;
     try {
-        /*int niter = */ solver.minimize(fun, x, fx, lb, ub);
-    } catch (std::exception& e) {
-        std::cerr << e.what() << std::endl;
+        // a warm start is used only if it fits the sample variogram better than the initial parameters, so that a poor
+        // solution in a neighbouring anchor point cannot lead the optimizer further from the minimum
+        if (start != m_initialparameters && fun(start) < fun(m_initialparameters)) {
+            x = start;
+        }
+        double projgnorm = 0;
+        double epsilon_rel = 0;
+        started = true;
+        if (m_solver == "lm") {
+            // the objective is a sum of squared residuals, whose structure is exploited by Levenberg-Marquardt
+            iterations = workspace.m_lm.minimize(fun, x, fx, m_lowerbound, m_upperbound);
+            projgnorm = workspace.m_lm.final_grad_norm();
+            epsilon_rel = Tolerances::param_epsilon_rel;
+        } else {
+            iterations = workspace.m_lbfgsb.minimize(fun, x, fx, m_lowerbound, m_upperbound);
+            projgnorm = workspace.m_lbfgsb.final_grad_norm();
+            epsilon_rel = workspace.m_param.epsilon_rel;
+        }
+        // the solvers return the iteration in which they stopped, which is the last one allowed also when the
+        // convergence test is met there, hence the budget is reported as exhausted only if the test failed
+        if (m_max_iterations > 0 && iterations >= m_max_iterations
+            && projgnorm > std::max(Tolerances::param_epsilon, epsilon_rel * x.norm())) {
+            status = FitStatus::iteration_budget;
+        }
+    } catch (BudgetExceeded& e) {
+        // the point held by the optimizer may be a trial one, hence the best one evaluated is returned instead
+        status = e.m_status;
+        if (started) {
+            iterations = m_solver == "lm" ? workspace.m_lm.iterations() : workspace.m_lbfgsb.iterations();
+        }
+        if (fun.m_best < std::numeric_limits<double>::infinity()) {
+            x = fun.m_bestparams;
+            fx = fun.m_best;
+        } else {
+            x = m_initialparameters;
+            fx = std::numeric_limits<double>::quiet_NaN();
+        }
+    } catch (std::exception&) {
+        // the failure is reported by the status of the anchor point
+        status = FitStatus::failed;
+        if (started) {
+            iterations = m_solver == "lm" ? workspace.m_lm.iterations() : workspace.m_lbfgsb.iterations();
+        }
         x = m_initialparameters;
+        fx = std::numeric_limits<double>::quiet_NaN();
     }
-    return x;
+
+    m_solutions->row(pos) = x.transpose();
+    m_iterations->operator()(pos) = iterations;
+    m_status->operator()(pos) = static_cast<int>(status);
+    m_evaluations->operator()(pos) = fun.m_evaluations;
+    m_gradient_evaluations->operator()(pos) = fun.m_gradient_evaluations;
+    m_objective->operator()(pos) = fx;
+    m_times->operator()(pos) = (omp_get_wtime() - begin) * 1000;
 }
 
-void Opt::findallsolutions()
+template <class Variogram>
+void Opt::solve_wavefronts(
+    const Variogram& gammaiso, const std::vector<vectorind>& wavefronts, const vectorind& parents)
 {
-    #pragma omp parallel for
-    for (size_t i = 0; i < m_empiricvariogram->cols(); ++i) {
-        vector sol = findonesolution(i);
-        for (size_t j = 0; j < m_initialparameters.size(); ++j) {
-            m_solutions->operator()(i, j) = sol[j];
+    size_t N = m_empiricvariogram->cols();
+    m_busytimes = std::make_shared<vector>(vector::Zero(omp_get_max_threads()));
+    size_t n_threads = 1;
+    m_deadline = omp_get_wtime() + m_time_limit;
+
+    #pragma omp parallel
+    {
+        OptWorkspace<Variogram> workspace(m_bins, gammaiso, m_initialparameters.size(), m_max_iterations);
+        double busy = 0;
+        // the implicit barrier at the end of each loop makes every wavefront wait for the previous one
+        for (const vectorind& wavefront : wavefronts) {
+            #pragma omp for schedule(dynamic)
+            for (size_t k = 0; k < wavefront.size(); ++k) {
+                size_t i = wavefront[k];
+                if (parents[i] < N) {
+                    workspace.m_start = m_solutions->row(parents[i]).transpose();
+                } else {
+                    workspace.m_start = m_initialparameters;
+                }
+                findonesolution(workspace, i);
+                busy += m_times->operator()(i);
+            }
         }
+        m_busytimes->operator()(omp_get_thread_num()) = busy;
+        #pragma omp master
+        n_threads = omp_get_num_threads();
+    }
+    m_busytimes->conservativeResize(n_threads);
+}
+
+void Opt::solve_wavefronts(std::vector<vectorind> wavefronts, const vectorind& parents)
+{
+    // the cost of an anchor point grows with its number of cells, so the most expensive ones are handed out first and
+    // the cheap ones fill the gaps at the end of each wavefront
+    const vectorind& start = m_bins->start;
+    for (vectorind& wavefront : wavefronts) {
+        std::stable_sort(wavefront.begin(), wavefront.end(),
+            [&](const size_t& i, const size_t& j) { return start[i + 1] - start[i] > start[j + 1] - start[j]; });
     }
+    // every cell is evaluated at least once: a variogram whose tables do not depend on the fitted parameters can build
+    // them here, before it is copied into the workspace of each thread
+    std::visit([&](auto& gammaiso) { gammaiso.prepare(m_bins->gamma.size()); }, m_gammaiso);
+    // select the variogram function once, so that the whole minimization is compiled for its concrete type
+    std::visit([&](const auto& gammaiso) { solve_wavefronts(gammaiso, wavefronts, parents); }, m_gammaiso);
+}
+
+std::vector<vectorind> Opt::build_wavefronts(const cd::matrixptr& anchorpoints, vectorind& parents) const
+{
+    const matrix& A = *(anchorpoints);
+    size_t N = A.rows();
+
+    // the anchor points are the centres of the tiles of a regular grid, hence the smallest gap between two different
+    // abscissas (ordinates) is the width (height) of a tile and gives the position of each anchor point on the grid
+    std::vector<std::vector<long>> index(2, std::vector<long>(N, 0));
+    for (size_t c = 0; c < 2; ++c) {
+        std::vector<double> sorted(A.col(c).data(), A.col(c).data() + N);
+        std::sort(sorted.begin(), sorted.end());
+        double range = sorted.back() - sorted.front();
+        double step = range;
+        for (size_t i = 1; i < N; ++i) {
+            double gap = sorted[i] - sorted[i - 1];
+            if (gap > Tolerances::anchor_tolerance * range) {
+                step = std::min(step, gap);
+            }
+        }
+        if (step > 0) {
+            for (size_t i = 0; i < N; ++i) {
+                index[c][i] = std::lround((A(i, c) - sorted.front()) / step);
+            }
+        }
+    }
+
+    // the anchor points on the same diagonal of the grid form a wavefront and do not depend on each other
+    std::vector<vectorind> wavefronts;
+    for (size_t i = 0; i < N; ++i) {
+        size_t w = index[0][i] + index[1][i];
+        if (w >= wavefronts.size()) {
+            wavefronts.resize(w + 1);
+        }
+        wavefronts[w].push_back(i);
+    }
+
+    // two anchor points in wavefronts d apart are at least d / sqrt(2) tiles away, so the search for the nearest anchor
+    // point in a previous wavefront stops as soon as no closer one can be found
+    parents.assign(N, N);
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < N; ++i) {
+        size_t w = index[0][i] + index[1][i];
+        double best = std::numeric_limits<double>::infinity();
+        for (size_t d = 1; d <= w && d * d < 2 * best; ++d) {
+            for (const size_t& j : wavefronts[w - d]) {
+                long dx = index[0][i] - index[0][j];
+                long dy = index[1][i] - index[1][j];
+                if (dx * dx + dy * dy < best) {
+                    best = dx * dx + dy * dy;
+                    parents[i] = j;
+                }
+            }
+        }
+    }
+    return wavefronts;
+}
+
+void Opt::set_budget(const double& max_iterations, const double& max_evaluations, const double& time_limit)
+{
+    m_max_iterations = max_iterations > 0 && std::isfinite(max_iterations) ? max_iterations : 0;
+    m_max_evaluations = max_evaluations > 0 && std::isfinite(max_evaluations) ? max_evaluations : 0;
+    m_time_limit = time_limit > 0 ? time_limit : std::numeric_limits<double>::infinity();
+}
+
+void Opt::findallsolutions()
+{
+    // without warm starts all the anchor points are independent and form a single wavefront
+    size_t N = m_empiricvariogram->cols();
+    std::vector<vectorind> wavefronts(1, vectorind(N));
+    std::iota(wavefronts[0].begin(), wavefronts[0].end(), 0);
+    solve_wavefronts(wavefronts, vectorind(N, N));
+}
+
+void Opt::findallsolutions(const cd::matrixptr& anchorpoints)
+{
+    vectorind parents;
+    std::vector<vectorind> wavefronts = build_wavefronts(anchorpoints, parents);
+    solve_wavefronts(wavefronts, parents);
 }
 
 cd::matrixptr Opt::get_solutions() const { return m_solutions; }
+
+cd::vectorptr Opt::get_iterations() const { return m_iterations; }
+
+cd::vectorptr Opt::get_times() const { return m_times; }
+
+cd::vectorptr Opt::get_busy_times() const { return m_busytimes; }
+
+cd::vectorIptr Opt::get_status() const { return m_status; }
+
+cd::vectorptr Opt::get_evaluations() const { return m_evaluations; }
+
+cd::vectorptr Opt::get_gradient_evaluations() const { return m_gradient_evaluations; }
+
+cd::vectorptr Opt::get_objective() const { return m_objective; }
 } // namespace LocallyStationaryModels
@@ -5,22 +5,21 @@
 #define LOCALLY_STATIONARY_MODELS_GRADIENT
 
 #include "LBFGS/LBFGSB.h"
+#include "levenbergmarquardt.hpp"
 #include "traits.hpp"
 #include "variogramfunctions.hpp"
 
 namespace LocallyStationaryModels {
 /**
- * \brief functor to pass to the optimizer that contains the wls to be minimized
+ * \brief the data needed to fit the variogram in every anchor point, packed anchor point by anchor point and keeping
+ * only the cells of the grid with a non-zero weight, so that each objective evaluation reads contiguous memory
  */
-struct TargetFunction {
-    const cd::matrixptr m_empiricvariogram; ///< sample variogram matrix
-    const cd::matrixptr m_squaredweights; ///< matrix of the squared weights
-    const cd::vectorptr
-        m_mean_x; ///< vector with the x of each cell of the grid (mean of the x of all the pairs inside)
-    const cd::vectorptr
-        m_mean_y; ///< vector with the y of each cell of the grid (mean of the y of all the pairs inside)
-    size_t m_x0; ///< index of the position where to evaluate gammaisoptr
-    std::shared_ptr<VariogramFunction> m_gammaisoptr; ///< pointer to the variogram function
+struct PackedBins {
+    cd::vectorind start; ///< position of the first cell of each anchor point, followed by the number of cells
+    cd::vector w; ///< squared weight of each cell
+    cd::vector gamma; ///< sample variogram in each cell
+    cd::vector x; ///< x of each cell (mean of the x of all the pairs inside)
+    cd::vector y; ///< y of each cell (mean of the y of all the pairs inside)
 
     /**
      * \brief constructor
@@ -28,11 +27,75 @@ struct TargetFunction {
      * \param squaredweights a shared pointer to the squared weights
      * \param mean_x a shared pointer to the vector of the abscissas of the centers
      * \param mean_y a shared pointer to the vector of the ordinates of the centers
+     */
+    PackedBins(const cd::matrixptr& empiricvariogram, const cd::matrixptr& squaredweights,
+        const cd::vectorptr& mean_x, const cd::vectorptr& mean_y);
+}; // struct PackedBins
+
+/**
+ * \brief how the fit in an anchor point ended
+ */
+enum class FitStatus : int {
+    converged = 0, ///< the optimizer met its stopping criterion
+    iteration_budget = 1, ///< the optimizer used all its iterations without meeting its stopping criterion
+    evaluation_budget = 2, ///< the optimizer used all its evaluations of the wls and the best point found is returned
+    deadline = 3, ///< the time limit of the whole fit expired and the best point found is returned
+    failed = 4 ///< the optimizer threw an exception and the initial parameters are returned
+};
+
+/**
+ * \brief thrown by TargetFunction when the fit of an anchor point exceeds its budget, so that the optimizer is
+ * interrupted wherever it is
+ */
+struct BudgetExceeded : public std::exception {
+    FitStatus m_status; ///< the budget which has been exceeded
+
+    /**
+     * \brief constructor
+     * \param status the budget which has been exceeded
+     */
+    BudgetExceeded(const FitStatus& status)
+        : m_status(status) {};
+
+    const char* what() const noexcept override { return "the budget of the fit has been exceeded"; }
+}; // struct BudgetExceeded
+
+/**
+ * \brief functor to pass to the optimizer that contains the wls to be minimized
+ * \tparam Variogram one of the variogram functions, so that the loop over the cells is compiled for it
+ */
+template <class Variogram> struct TargetFunction {
+    const std::shared_ptr<const PackedBins> m_bins; ///< cells of the grid with non-zero weight of every anchor point
+    size_t m_begin; ///< position in m_bins of the first cell of the anchor point x0
+    size_t m_end; ///< position in m_bins past the last cell of the anchor point x0
+    Variogram m_gammaiso; ///< variogram function
+    cd::vector m_dgamma; ///< gradient of the variogram in a cell, allocated once
+    size_t m_evaluations = 0; ///< number of evaluations of the wls since the last call to set_budget
+    size_t m_gradient_evaluations = 0; ///< how many of m_evaluations computed the gradient too
+    size_t m_max_evaluations = 0; ///< number of evaluations of the wls allowed, 0 for no limit
+    double m_deadline = std::numeric_limits<double>::infinity(); ///< omp_get_wtime() after which the fit is stopped
+    double m_best = std::numeric_limits<double>::infinity(); ///< smallest value of the wls found so far
+    cd::vector m_bestparams; ///< parameters where m_best has been found
+
+    /**
+     * \brief throw BudgetExceeded if the next evaluation of the wls would exceed the budget
+     */
+    void check_budget();
+
+    /**
+     * \brief count an evaluation of the wls and keep track of the best parameters found so far
+     */
+    void record(const cd::vector& params, const double& value);
+
+    /**
+     * \brief constructor
+     * \param bins a shared pointer to the packed cells of every anchor point
      * \param x0 the index of the position x0
-     * \param id the name of the variogram of your choice
+     * \param gammaiso the variogram function
+     * \param n_params the number of parameters of the variogram
      */
-    TargetFunction(const cd::matrixptr& empiricvariogram, const cd::matrixptr& squaredweights,
-        const cd::vectorptr& mean_x, const cd::vectorptr& mean_y, const size_t& x0, const std::string& id);
+    TargetFunction(const std::shared_ptr<const PackedBins>& bins, const size_t& x0, const Variogram& gammaiso,
+        const size_t& n_params);
 
     /**
      * \param params a vector containing the previous value of the parameters of the function (lambda1, lambda2, phi,
@@ -46,8 +109,55 @@ struct TargetFunction {
      * sigma, etc.)
      */
     double operator()(const cd::vector& params);
+
+    /**
+     * \brief build the normal equations of the Gauss-Newton method, where the residual in each cell is the difference
+     * between the variogram and the sample variogram multiplied by the square root of the weight of the cell
+     * \param params a vector containing the current value of the parameters of the function
+     * \param JtJ filled with the product of the transposed jacobian of the residuals and the jacobian
+     * \param Jtr filled with the product of the transposed jacobian of the residuals and the residuals
+     * \return the value of the wls, i.e. the sum of the squared residuals
+     */
+    double normal_equations(const cd::vector& params, cd::matrix& JtJ, cd::vector& Jtr);
+
+    /**
+     * \brief move the function to another anchor point
+     * \param x0 the index of the position x0
+     */
+    void set_anchor(const size_t& x0);
+
+    /**
+     * \brief set the budget of the next fit and forget the best parameters found so far
+     * \param max_evaluations the number of evaluations of the wls allowed, 0 for no limit
+     * \param deadline the value of omp_get_wtime() after which the fit is stopped
+     */
+    void set_budget(const size_t& max_evaluations, const double& deadline);
 }; // struct TargetFunction
 
+/**
+ * \brief the state of the optimizers and the scratch vectors of a thread, built once and reused for all the anchor
+ * points solved by the thread, so that the fit does not allocate memory after the first anchor point
+ * \tparam Variogram one of the variogram functions
+ */
+template <class Variogram> struct OptWorkspace {
+    LBFGSpp::LBFGSBParam<double> m_param; ///< parameters of L-BFGS-B, referenced by m_lbfgsb
+    LBFGSpp::LBFGSBSolver<double> m_lbfgsb; ///< L-BFGS-B solver
+    LMSolver m_lm; ///< Levenberg-Marquardt solver
+    TargetFunction<Variogram> m_fun; ///< wls of the current anchor point
+    cd::vector m_x; ///< current point of the optimizer
+    cd::vector m_start; ///< warm start of the current anchor point
+
+    /**
+     * \brief constructor
+     * \param bins a shared pointer to the packed cells of every anchor point
+     * \param gammaiso the variogram function
+     * \param n_params the number of parameters of the variogram
+     * \param max_iterations the number of iterations allowed to the optimizers, 0 for no limit
+     */
+    OptWorkspace(const std::shared_ptr<const PackedBins>& bins, const Variogram& gammaiso, const size_t& n_params,
+        const size_t& max_iterations);
+}; // struct OptWorkspace
+
 /**
  * \brief a class to estimate the value of the parameters of the variogram in each point by optimizing the correspondent
  * funzionedaottimizzare relying on the library LBFGSpp
@@ -59,16 +169,63 @@ private:
     cd::vectorptr m_mean_x; ///< vector with the x of each cell of the grid (mean of the x of all the pairs inside)
     cd::vectorptr m_mean_y; ///< vector with the y of each cell of the grid (mean of the y of all the pairs inside)
     std::string m_id; ///< name of the chosen variogram
+    variogramfunction m_gammaiso; ///< variogram function built from m_id
     cd::vector m_initialparameters; ///< initial parameters for the optimizer
     cd::vector m_lowerbound; ///< lower bounds for the optimizer
     cd::vector m_upperbound; ///< upper bounds for the optimizer
+    std::string m_solver; ///< name of the chosen optimizer, "lbfgsb" or "lm"
     cd::matrixptr m_solutions = nullptr; ///< matrix with the solution in all the anchor points
+    cd::vectorptr m_iterations = nullptr; ///< number of iterations of the optimizer in each anchor point
+    cd::vectorptr m_times = nullptr; ///< time in milliseconds spent by the optimizer in each anchor point
+    cd::vectorptr m_busytimes = nullptr; ///< time in milliseconds spent by each thread solving anchor points
+    cd::vectorIptr m_status = nullptr; ///< how the fit ended in each anchor point, see FitStatus
+    cd::vectorptr m_evaluations = nullptr; ///< number of evaluations of the wls in each anchor point
+    cd::vectorptr m_gradient_evaluations = nullptr; ///< number of evaluations of its gradient in each anchor point
+    cd::vectorptr m_objective = nullptr; ///< value of the wls in the solution of each anchor point
+    size_t m_max_iterations = Tolerances::param_max_iterations; ///< iterations allowed per anchor point, 0 for no limit
+    size_t m_max_evaluations = 0; ///< evaluations of the wls allowed in each anchor point, 0 for no limit
+    double m_time_limit = std::numeric_limits<double>::infinity(); ///< seconds allowed for the whole fit
+    double m_deadline = std::numeric_limits<double>::infinity(); ///< omp_get_wtime() at which the current fit ends
+    std::shared_ptr<const PackedBins> m_bins = nullptr; ///< cells with non-zero weight of every anchor point
 
     /**
-     * \brief find the optimal solution for the point in position pos
+     * \brief find the optimal solution for the point in position pos, store it and record the effort of the optimizer
+     * \param workspace the workspace of the calling thread, holding the point from which the optimizer starts if it
+     * fits better than the initial parameters
      * \param pos the index of the position in which find the optimal solution
      */
-    cd::vector findonesolution(const size_t& pos) const;
+    template <class Variogram> void findonesolution(OptWorkspace<Variogram>& workspace, const size_t& pos);
+
+    /**
+     * \brief solve the wavefronts one after the other and the anchor points inside each of them in parallel, each
+     * thread reusing the same workspace for all its anchor points
+     * \param gammaiso the variogram function
+     * \param wavefronts the indices of the anchor points in each wavefront
+     * \param parents the index of the anchor point whose solution is the warm start of each anchor point, or the number
+     * of anchor points to start from the initial parameters
+     */
+    template <class Variogram>
+    void solve_wavefronts(
+        const Variogram& gammaiso, const std::vector<cd::vectorind>& wavefronts, const cd::vectorind& parents);
+
+    /**
+     * \brief select the variogram function and solve the wavefronts, handing out the anchor points of each wavefront
+     * from the one with the most cells to the one with the fewest
+     * \param wavefronts the indices of the anchor points in each wavefront
+     * \param parents the index of the anchor point whose solution is the warm start of each anchor point, or the number
+     * of anchor points to start from the initial parameters
+     */
+    void solve_wavefronts(std::vector<cd::vectorind> wavefronts, const cd::vectorind& parents);
+
+    /**
+     * \brief sort the anchor points in wavefronts along the diagonals of the grid they lie on and pair each of them
+     * with the nearest anchor point in a previous wavefront
+     * \param anchorpoints a shared pointer to the matrix with the coordinates of the anchor points
+     * \param parents filled with the index of the anchor point paired with each anchor point, or with the number of
+     * anchor points if there is none
+     * \return the indices of the anchor points in each wavefront
+     */
+    std::vector<cd::vectorind> build_wavefronts(const cd::matrixptr& anchorpoints, cd::vectorind& parents) const;
 
 public:
     /**
@@ -82,20 +239,89 @@ public:
      * a minimum 
      * \param lowerbound the lower bounds for the parameters in the nonlinear optimization problem 
      * \param upperbound the upper bounds for the parameters in the nonlinear optimization problem
+     * \param solver the name of the optimizer, "lbfgsb" for L-BFGS-B or "lm" for Levenberg-Marquardt
+     */
+    Opt(const cd::matrixptr& empiricvariogram, const cd::matrixptr& squaredweights, const cd::vectorptr& mean_x,
+        const cd::vectorptr& mean_y, const std::string& id, const cd::vector& initialparameters,
+        const cd::vector& lowerbound, const cd::vector& upperbound, const std::string& solver);
+
+    /**
+     * \brief constructor, solving the problems with L-BFGS-B
+     * \param empiricvariogram a shared pointer to the empiric variogram
+     * \param squaredweights a shared pointer to the squared weights
+     * \param mean_x a shared pointer to the vector of the abscissas of the centers
+     * \param mean_y a shared pointer to the vector of the ordinates of the centers
+     * \param id the name of the variogram of your choice
+     * \param initialparameters the initial value of the parameters required from the optimizer to start the search for
+     * a minimum
+     * \param lowerbound the lower bounds for the parameters in the nonlinear optimization problem
+     * \param upperbound the upper bounds for the parameters in the nonlinear optimization problem
      */
     Opt(const cd::matrixptr& empiricvariogram, const cd::matrixptr& squaredweights, const cd::vectorptr& mean_x,
         const cd::vectorptr& mean_y, const std::string& id, const cd::vector& initialparameters,
         const cd::vector& lowerbound, const cd::vector& upperbound);
 
+    /**
+     * \brief limit the effort of the optimizer, the anchor points which exceed it keep the best parameters found so far
+     * and report it in their status. Each limit is ignored if it is not positive or it is infinite
+     * \param max_iterations the number of iterations allowed in each anchor point
+     * \param max_evaluations the number of evaluations of the wls allowed in each anchor point
+     * \param time_limit the number of seconds allowed for the whole fit
+     */
+    void set_budget(const double& max_iterations, const double& max_evaluations, const double& time_limit);
+
     /**
      * \brief find the optimal solution in all the position
      */
     void findallsolutions();
 
+    /**
+     * \brief find the optimal solution in all the position visiting the anchor points one wavefront at a time, so that
+     * the optimizer in each anchor point can start from the solution of a neighbouring one
+     * \param anchorpoints a shared pointer to the matrix with the coordinates of the anchor points
+     */
+    void findallsolutions(const cd::matrixptr& anchorpoints);
+
     /**
      * \return the solutions found by solving the problem of nonlinear optimization
      */
     cd::matrixptr get_solutions() const;
+
+    /**
+     * \return the number of iterations of the optimizer in each anchor point
+     */
+    cd::vectorptr get_iterations() const;
+
+    /**
+     * \return the time in milliseconds spent by the optimizer in each anchor point
+     */
+    cd::vectorptr get_times() const;
+
+    /**
+     * \return the time in milliseconds spent by each thread solving anchor points, whose spread shows how well the
+     * work was balanced
+     */
+    cd::vectorptr get_busy_times() const;
+
+    /**
+     * \return how the fit ended in each anchor point, as the integer values of FitStatus
+     */
+    cd::vectorIptr get_status() const;
+
+    /**
+     * \return the number of evaluations of the wls in each anchor point
+     */
+    cd::vectorptr get_evaluations() const;
+
+    /**
+     * \return the number of evaluations of the gradient of the wls, or of its normal equations, in each anchor point
+     */
+    cd::vectorptr get_gradient_evaluations() const;
+
+    /**
+     * \return the value of the wls in the solution of each anchor point, NaN where the fit failed
+     */
+    cd::vectorptr get_objective() const;
 }; // class Opt
 } // namespace LocallyStationaryModels
 
@@ -6,99 +6,70 @@
 namespace LocallyStationaryModels {
 using namespace cd;
 
-double VariogramFunction::compute_anisotropic_h(
-    const double& lambda1, const double& lambda2, const double& phi, const double& x, const double& y)
+MaternTable::MaternTable(const double& nu)
+    : m_nu(nu)
+    , m_normalization(std::tgamma(nu) * std::pow(2, nu - 1))
 {
-    double xx = x * x;
-    double yy = y * y;
-    double xy = x * y;
+    // the second derivative of the correlation, needed to interpolate the first one, is
+    // (u^nu K_(nu-2)(u) - u^(nu-1) K_(nu-1)(u)) / normalization
+    auto node = [&](const double& u) {
+        double drho;
+        double rho = exact(m_nu, m_normalization, u, drho);
+        double ddrho = (std::pow(u, m_nu) * std::cyl_bessel_k(std::abs(m_nu - 2), u)
+                           - std::pow(u, m_nu - 1) * std::cyl_bessel_k(std::abs(m_nu - 1), u))
+            / m_normalization;
+        m_rho.push_back(rho);
+        m_drho.push_back(drho);
+        m_ddrho.push_back(ddrho);
+    };
 
-    return sqrt((lambda2 * lambda2 * xx * cos(phi) * cos(phi) + lambda1 * lambda1 * yy * cos(phi) * cos(phi)
-                    + lambda1 * lambda1 * xx * sin(phi) * sin(phi) + lambda2 * lambda2 * yy * sin(phi) * sin(phi)
-                    + lambda1 * lambda1 * xy * sin(2 * phi) - lambda2 * lambda2 * xy * sin(2 * phi))
-        / (lambda1 * lambda1 * lambda2 * lambda2));
-}
-
-double Exponential::operator()(const cd::vector& params, const double& x, const double& y)
-{
-    double lambda1 = params[0];
-    double lambda2 = params[1];
-    double phi = params[2];
-    double sigma = params[3];
-
-    double h = compute_anisotropic_h(lambda1, lambda2, phi, x, y);
-    return sigma * sigma * (1 - exp(-h));
-}
-
-double Matern::operator()(const cd::vector& params, const double& x, const double& y)
-{
-    double lambda1 = params[0];
-    double lambda2 = params[1];
-    double phi = params[2];
-    double sigma = params[3];
-    double nu = params[4];
-
-    if (std::abs(x) < Tolerances::min_norm && std::abs(y) < Tolerances::min_norm) {
-        return Tolerances::infinity;
+    // the correlation is 1 in 0, where the derivatives may be singular: the first interval is always evaluated exactly
+    m_rho.push_back(1);
+    m_drho.push_back(0);
+    m_ddrho.push_back(0);
+    const double tolerance = Tolerances::matern_table_tolerance;
+    for (size_t i = 1; i < Tolerances::matern_table_max_nodes; ++i) {
+        node(i * m_step);
+        if (m_rho.back() < tolerance && std::abs(m_drho.back()) < tolerance) {
+            break;
+        }
     }
 
-    double h = compute_anisotropic_h(lambda1, lambda2, phi, x, y);
-    return sigma * sigma
-        * (1
-            - std::pow(std::sqrt(2 * nu) * h, nu) * std::cyl_bessel_k(nu, std::sqrt(2 * nu) * h)
-                / (std::tgamma(nu) * std::pow(2, nu - 1)));
-}
-
-double MaternNuFixed::operator()(const cd::vector& params, const double& x, const double& y)
-{
-    double lambda1 = params[0];
-    double lambda2 = params[1];
-    double phi = params[2];
-    double sigma = params[3];
-    double nu = m_nu;
-
-    if (std::abs(x) < Tolerances::min_norm && std::abs(y) < Tolerances::min_norm) {
-        return Tolerances::infinity;
+    // compare the interpolation with the exact value in the middle of each interval
+    m_exact.assign(m_rho.size() - 1, 0);
+    m_exact[0] = 1;
+    for (size_t i = 1; i < m_exact.size(); ++i) {
+        double u = (i + 0.5) * m_step;
+        double drho;
+        double rho = (*this)(u, drho);
+        double exactdrho;
+        double exactrho = exact(m_nu, m_normalization, u, exactdrho);
+        if (std::abs(rho - exactrho) > tolerance || std::abs(drho - exactdrho) > tolerance) {
+            m_exact[i] = 1;
+        }
     }
-
-    double h = compute_anisotropic_h(lambda1, lambda2, phi, x, y);
-    return sigma * sigma
-        * (1
-            - std::pow(std::sqrt(2 * nu) * h, nu) * std::cyl_bessel_k(nu, std::sqrt(2 * nu) * h)
-                / (std::tgamma(nu) * std::pow(2, nu - 1)));
-}
-
-double Gaussian::operator()(const cd::vector& params, const double& x, const double& y)
-{
-    double lambda1 = params[0];
-    double lambda2 = params[1];
-    double phi = params[2];
-    double sigma = params[3];
-
-    double h = compute_anisotropic_h(lambda1, lambda2, phi, x, y);
-    return sigma * sigma * (1 - exp(-h * h));
 }
 
-std::shared_ptr<VariogramFunction> make_variogramiso(const std::string& id)
+variogramfunction make_variogramiso(const std::string& id)
 {
     if (id == "exponential" || id == "esponenziale") {
-        return std::make_shared<Exponential>();
+        return Exponential();
     }
     if (id == "matern" || id == "Matern") {
-        return std::make_shared<Matern>();
+        return Matern();
     }
     if (id == "gaussian" || id == "Gaussian") {
-        return std::make_shared<Gaussian>();
+        return Gaussian();
     }
     // using the following method we can set directly from R passing a string a constant value for nu
     if (id.substr(0, 13) == "maternNuFixed") {
         try {
             double NU = std::stod(id.substr(14));
-            return std::make_shared<MaternNuFixed>(NU);
+            return MaternNuFixed(NU);
         } catch (std::exception& e) {
-            return std::make_shared<Exponential>();
+            return Exponential();
         }
     }
-    return std::make_shared<Exponential>();
+    return Exponential();
 }
 } // namespace LocallyStationaryModels
@@ -6,74 +6,452 @@
 
 #include "traits.hpp"
 
+#include <variant>
+
 namespace LocallyStationaryModels {
-class VariogramFunction {
+/**
+ * \brief base of the variogram functions, where Derived is the concrete variogram. set_params computes once the
+ * anisotropy transform of the parameters, so that evaluating the variogram in a lag only costs a rotation and a
+ * scaling, and since Derived is known at compile time its evaluation can be inlined in the loops of the fit and of
+ * kriging
+ */
+template <class Derived> class VariogramFunction {
 protected:
+    cd::vector m_params; ///< current value of the parameters
+    double m_lambda1 = 1; ///< lambda1
+    double m_lambda2 = 1; ///< lambda2
+    double m_sigma = 1; ///< sigma
+    double m_cos = 1; ///< cosine of phi
+    double m_sin = 0; ///< sine of phi
+    double m_inverse1 = 1; ///< 1 / lambda1^2
+    double m_inverse2 = 1; ///< 1 / lambda2^2
+
     /**
      * \brief convert the isotropic variogram in the equivalent anisotropic one calculating the norm of the spatial lag
      * rotated and expanded according to the eigenvalues and eigenvector of the anisotropy matrix
      */
-    double compute_anisotropic_h(
-        const double& lambda1, const double& lambda2, const double& phi, const double& x, const double& y);
+    double compute_anisotropic_h(const double& x, const double& y) const
+    {
+        // h^2 = a^2/lambda1^2 + b^2/lambda2^2, where (a, b) is the lag rotated by phi
+        double a = x * m_cos - y * m_sin;
+        double b = x * m_sin + y * m_cos;
+        return std::sqrt(a * a * m_inverse1 + b * b * m_inverse2);
+    }
+
+    /**
+     * \brief compute the anisotropic norm of the spatial lag as above together with its partial derivatives with
+     * respect to lambda1, lambda2 and phi, which are set to 0 if the norm is 0
+     * \param dh a vector overwritten with the three partial derivatives
+     */
+    double compute_anisotropic_h(const double& x, const double& y, Eigen::Vector3d& dh) const
+    {
+        double a = x * m_cos - y * m_sin;
+        double b = x * m_sin + y * m_cos;
+        double h = std::sqrt(a * a * m_inverse1 + b * b * m_inverse2);
+
+        if (h < Tolerances::min_norm) {
+            dh.setZero();
+            return h;
+        }
+        dh[0] = -a * a * m_inverse1 / (m_lambda1 * h);
+        dh[1] = -b * b * m_inverse2 / (m_lambda2 * h);
+        // da/dphi = -b and db/dphi = a
+        dh[2] = a * b * (m_inverse2 - m_inverse1) / h;
+        return h;
+    }
 
 public:
-    VariogramFunction() = default;
     /**
-     * \brief return f(params, x, y)
+     * \brief store the parameters and precompute the anisotropy transform
+     * \param params a vector with lambda1, lambda2, phi, sigma and the other parameters of Derived in this exact order
+     */
+    void set_params(const cd::vector& params)
+    {
+        m_params = params;
+        m_lambda1 = params[0];
+        m_lambda2 = params[1];
+        m_sigma = params[3];
+        m_cos = std::cos(params[2]);
+        m_sin = std::sin(params[2]);
+        m_inverse1 = 1 / (m_lambda1 * m_lambda1);
+        m_inverse2 = 1 / (m_lambda2 * m_lambda2);
+    }
+
+    /**
+     * \brief hint that the variogram is about to be evaluated n_evaluations times with the same parameters, so that it
+     * can precompute what repays its cost. It does nothing by default
      */
-    virtual double operator()(const cd::vector& params, const double& x, const double& y) = 0;
+    void prepare(const size_t&) { }
+
+    /**
+     * \brief compute the value of the variogram and store in grad its partial derivatives with respect to the
+     * parameters, with central differences whose step is proportional to each parameter. This is the fallback for the
+     * variograms without a closed-form gradient, the others hide it with their own gradient
+     */
+    double gradient(const double& x, const double& y, cd::vector& grad) const
+    {
+        const Derived& self = static_cast<const Derived&>(*this);
+        Derived shifted(self);
+        cd::vector paramsdelta(m_params);
+        for (size_t i = 0; i < m_params.size(); ++i) {
+            double increment = Tolerances::gradient_step * m_params[i];
+            paramsdelta[i] = m_params[i] + increment;
+            shifted.set_params(paramsdelta);
+            double valueplus = shifted(x, y);
+            paramsdelta[i] = m_params[i] - increment;
+            shifted.set_params(paramsdelta);
+            double valueminus = shifted(x, y);
+            paramsdelta[i] = m_params[i];
+            grad[i] = (valueplus - valueminus) / (2 * increment);
+        }
+        return self(x, y);
+    }
 }; // class VariogramFunction
 
-class Exponential : public VariogramFunction {
+class Exponential : public VariogramFunction<Exponential> {
 public:
     Exponential() = default;
     /**
      * \return sigma * sigma * (1 - exp(-h))
-     * \param params a vector with lambda1, lambda2, phi and sigma in this exact order
      */
-    double operator()(const cd::vector& params, const double& x, const double& y) override;
+    double operator()(const double& x, const double& y) const
+    {
+        double h = compute_anisotropic_h(x, y);
+        return m_sigma * m_sigma * (1 - std::exp(-h));
+    }
+
+    /**
+     * \return the same value as above and store in grad its gradient, computed in closed form
+     */
+    double gradient(const double& x, const double& y, cd::vector& grad) const
+    {
+        Eigen::Vector3d dh;
+        double h = compute_anisotropic_h(x, y, dh);
+        double e = std::exp(-h);
+        grad.head<3>() = m_sigma * m_sigma * e * dh;
+        grad[3] = 2 * m_sigma * (1 - e);
+        return m_sigma * m_sigma * (1 - e);
+    }
 }; // class Exponential
 
-class Matern : public VariogramFunction {
+/**
+ * \brief table of the Matern correlation rho(u) = u^nu K_nu(u) / (Gamma(nu) 2^(nu-1)) and of its derivative for a
+ * fixed nu, interpolated with cubic Hermite polynomials on a uniform grid of u. The intervals where the interpolation
+ * error at the midpoint exceeds Tolerances::matern_table_tolerance are evaluated exactly instead
+ */
+class MaternTable {
+private:
+    double m_nu; ///< value of nu
+    double m_normalization; ///< std::tgamma(nu)*std::pow(2,nu-1)
+    double m_step = Tolerances::matern_table_step; ///< distance between two nodes
+    std::vector<double> m_rho; ///< correlation in each node
+    std::vector<double> m_drho; ///< first derivative of the correlation in each node
+    std::vector<double> m_ddrho; ///< second derivative of the correlation in each node
+    std::vector<char> m_exact; ///< 1 if the interval starting at the node is evaluated exactly, 0 otherwise
+
+public:
+    /**
+     * \brief constructor. Tabulate the correlation until both the correlation and its derivative are negligible
+     * \param nu the value of nu
+     */
+    MaternTable(const double& nu);
+
+    /**
+     * \return the correlation rho(u) computed with std::cyl_bessel_k and store in drho its derivative, using
+     * d(u^nu K_nu(u))/du = -u^nu K_(nu-1)(u) and K_(nu-1) = K_(1-nu). Both are 0 above
+     * Tolerances::matern_max_argument, where std::cyl_bessel_k would throw
+     * \param normalization std::tgamma(nu)*std::pow(2,nu-1)
+     */
+    static double exact(const double& nu, const double& normalization, const double& u, double& drho)
+    {
+        if (u > Tolerances::matern_max_argument) {
+            drho = 0;
+            return 0;
+        }
+        double unu = std::pow(u, nu);
+        drho = -unu * std::cyl_bessel_k(std::abs(nu - 1), u) / normalization;
+        return unu * std::cyl_bessel_k(nu, u) / normalization;
+    }
+
+    /**
+     * \return the correlation rho(u) computed with std::cyl_bessel_k, 0 above Tolerances::matern_max_argument
+     * \param normalization std::tgamma(nu)*std::pow(2,nu-1)
+     */
+    static double exact(const double& nu, const double& normalization, const double& u)
+    {
+        if (u > Tolerances::matern_max_argument) {
+            return 0;
+        }
+        return std::pow(u, nu) * std::cyl_bessel_k(nu, u) / normalization;
+    }
+
+    /**
+     * \return the interpolated correlation rho(u) and store in drho its derivative
+     */
+    double operator()(const double& u, double& drho) const
+    {
+        double t = u / m_step;
+        if (!(t < m_rho.size() - 1)) {
+            drho = 0;
+            return 0;
+        }
+        size_t i = static_cast<size_t>(t);
+        if (m_exact[i]) {
+            return exact(m_nu, m_normalization, u, drho);
+        }
+        double s = t - i;
+        double s2 = s * s;
+        double s3 = s2 * s;
+        double h00 = 2 * s3 - 3 * s2 + 1;
+        double h10 = (s3 - 2 * s2 + s) * m_step;
+        double h01 = 3 * s2 - 2 * s3;
+        double h11 = (s3 - s2) * m_step;
+        drho = h00 * m_drho[i] + h10 * m_ddrho[i] + h01 * m_drho[i + 1] + h11 * m_ddrho[i + 1];
+        return h00 * m_rho[i] + h10 * m_drho[i] + h01 * m_rho[i + 1] + h11 * m_drho[i + 1];
+    }
+
+    /**
+     * \return the interpolated correlation rho(u)
+     */
+    double operator()(const double& u) const
+    {
+        double t = u / m_step;
+        if (!(t < m_rho.size() - 1)) {
+            return 0;
+        }
+        size_t i = static_cast<size_t>(t);
+        if (m_exact[i]) {
+            return exact(m_nu, m_normalization, u);
+        }
+        double s = t - i;
+        double s2 = s * s;
+        double s3 = s2 * s;
+        return (2 * s3 - 3 * s2 + 1) * m_rho[i] + (s3 - 2 * s2 + s) * m_step * m_drho[i]
+            + (3 * s2 - 2 * s3) * m_rho[i + 1] + (s3 - s2) * m_step * m_drho[i + 1];
+    }
+}; // class MaternTable
+
+/**
+ * \brief common part of the Matern variograms, whose value is sigma * sigma *(1 - std::pow(std::sqrt(2*nu)*h,
+ * nu)*std::cyl_bessel_k(nu, std::sqrt(2*nu)*h)/(std::tgamma(nu)*std::pow(2,nu-1))). The correlation is computed in
+ * closed form if nu is 0.5, 1.5 or 2.5, from a MaternTable if one has been built for nu, and with std::cyl_bessel_k
+ * otherwise
+ */
+template <class Derived> class MaternFamily : public VariogramFunction<Derived> {
+protected:
+    double m_nu = 0.5; ///< value of nu
+    double m_scale = 1; ///< std::sqrt(2*nu)
+    double m_normalization = 1; ///< std::tgamma(nu)*std::pow(2,nu-1)
+    std::shared_ptr<const MaternTable> m_table = nullptr; ///< table of the correlation for m_nu, if any
+
+    /**
+     * \brief set nu and the constants which depend only on it, and discard the table if nu has changed
+     */
+    void set_nu(const double& nu)
+    {
+        if (nu != m_nu) {
+            m_table = nullptr;
+        }
+        m_nu = nu;
+        m_scale = std::sqrt(2 * nu);
+        m_normalization = std::tgamma(nu) * std::pow(2, nu - 1);
+    }
+
+    /**
+     * \return true if the correlation has a closed form for m_nu
+     */
+    bool closed_form() const { return m_nu == 0.5 || m_nu == 1.5 || m_nu == 2.5; }
+
+    /**
+     * \return the correlation at u = std::sqrt(2*nu)*h and store in drho its derivative with respect to u
+     */
+    double correlation(const double& u, double& drho) const
+    {
+        if (m_nu == 0.5) {
+            double e = std::exp(-u);
+            drho = -e;
+            return e;
+        }
+        if (m_nu == 1.5) {
+            double e = std::exp(-u);
+            drho = -u * e;
+            return (1 + u) * e;
+        }
+        if (m_nu == 2.5) {
+            double e = std::exp(-u);
+            drho = -u * (1 + u) * e / 3;
+            return (1 + u + u * u / 3) * e;
+        }
+        if (m_table) {
+            return (*m_table)(u, drho);
+        }
+        return MaternTable::exact(m_nu, m_normalization, u, drho);
+    }
+
+    /**
+     * \return the correlation at u = std::sqrt(2*nu)*h
+     */
+    double correlation(const double& u) const
+    {
+        if (m_nu == 0.5) {
+            return std::exp(-u);
+        }
+        if (m_nu == 1.5) {
+            return (1 + u) * std::exp(-u);
+        }
+        if (m_nu == 2.5) {
+            return (1 + u + u * u / 3) * std::exp(-u);
+        }
+        if (m_table) {
+            return (*m_table)(u);
+        }
+        return MaternTable::exact(m_nu, m_normalization, u);
+    }
+
+    /**
+     * \return the value of the variogram and store in the first four elements of grad its partial derivatives with
+     * respect to lambda1, lambda2, phi and sigma
+     */
+    double evaluate(const double& x, const double& y, cd::vector& grad) const
+    {
+        double sigma2 = this->m_sigma * this->m_sigma;
+        if (std::abs(x) < Tolerances::min_norm && std::abs(y) < Tolerances::min_norm) {
+            grad.setZero();
+            return Tolerances::infinity;
+        }
+
+        Eigen::Vector3d dh;
+        double h = this->compute_anisotropic_h(x, y, dh);
+        double drho;
+        double rho = correlation(m_scale * h, drho);
+        grad.head<3>() = -sigma2 * m_scale * drho * dh;
+        grad[3] = 2 * this->m_sigma * (1 - rho);
+        return sigma2 * (1 - rho);
+    }
+
 public:
-    Matern() = default;
     /**
      * \return sigma * sigma *(1 - std::pow(std::sqrt(2*nu)*h, nu)*std::cyl_bessel_k(nu,
-     * std::sqrt(2*nu)*h)/(std::tgamma(nu)*std::pow(2,nu-1))) 
+     * std::sqrt(2*nu)*h)/(std::tgamma(nu)*std::pow(2,nu-1)))
+     */
+    double operator()(const double& x, const double& y) const
+    {
+        if (std::abs(x) < Tolerances::min_norm && std::abs(y) < Tolerances::min_norm) {
+            return Tolerances::infinity;
+        }
+
+        double h = this->compute_anisotropic_h(x, y);
+        return this->m_sigma * this->m_sigma * (1 - correlation(m_scale * h));
+    }
+
+    /**
+     * \brief build the table of the correlation for the current nu if the variogram is going to be evaluated at least
+     * Tolerances::matern_table_min_evaluations times with it, so that the construction of the table is repaid
+     * \param n_evaluations the number of evaluations expected before the parameters change
+     */
+    void prepare(const size_t& n_evaluations)
+    {
+        if (!m_table && !closed_form() && n_evaluations >= Tolerances::matern_table_min_evaluations) {
+            m_table = std::make_shared<const MaternTable>(m_nu);
+        }
+    }
+}; // class MaternFamily
+
+class Matern : public MaternFamily<Matern> {
+private:
+    double m_increment = 0; ///< step for the forward difference with respect to nu
+    double m_scaleplus = 1; ///< std::sqrt(2*(nu+m_increment))
+    double m_normalizationplus = 1; ///< std::tgamma(nu+m_increment)*std::pow(2,nu+m_increment-1)
+
+public:
+    Matern() = default;
+
+    /**
+     * \brief store the parameters and precompute the anisotropy transform and the constants depending on nu
      * \param params a vector with lambda1, lambda2, phi, sigma and nu in this exact order
      */
-    double operator()(const cd::vector& params, const double& x, const double& y) override;
+    void set_params(const cd::vector& params)
+    {
+        VariogramFunction<Matern>::set_params(params);
+        set_nu(params[4]);
+        m_increment = Tolerances::gradient_step * m_nu;
+        m_scaleplus = std::sqrt(2 * (m_nu + m_increment));
+        m_normalizationplus = std::tgamma(m_nu + m_increment) * std::pow(2, m_nu + m_increment - 1);
+    }
+
+    /**
+     * \return the value of the variogram and store in grad its gradient, computed in closed form except for the
+     * derivative with respect to nu which is computed with a forward difference. The difference starts from the value
+     * of the variogram already computed, so that it costs a single std::cyl_bessel_k, unless that value comes from the
+     * table, whose interpolation error would be amplified by the difference
+     */
+    double gradient(const double& x, const double& y, cd::vector& grad) const
+    {
+        double value = evaluate(x, y, grad);
+        if (value == Tolerances::infinity) {
+            return value;
+        }
+        double h = compute_anisotropic_h(x, y);
+        double sigma2 = m_sigma * m_sigma;
+        double rho = m_table ? MaternTable::exact(m_nu, m_normalization, m_scale * h) : 1 - value / sigma2;
+        double rhoplus = MaternTable::exact(m_nu + m_increment, m_normalizationplus, m_scaleplus * h);
+        grad[4] = -sigma2 * (rhoplus - rho) / m_increment;
+        return value;
+    }
 }; // class Matern
 
-class MaternNuFixed : public VariogramFunction {
-private:
-    double m_nu = 0.5; ///< constant value of nu
+class MaternNuFixed : public MaternFamily<MaternNuFixed> {
 public:
-    MaternNuFixed(const double& nu)
-        : m_nu(nu) {};
     /**
-     * \return sigma * sigma *(1 - std::pow(std::sqrt(2*nu)*h, nu)*std::cyl_bessel_k(nu,
-     * std::sqrt(2*nu)*h)/(std::tgamma(nu)*std::pow(2,nu-1))) 
-     * \param params a vector with lambda1, lambda2, phi and sigma in this exact order
+     * \brief constructor. The correlation is tabulated by prepare only once enough evaluations are expected, and since
+     * nu never changes the table is then shared by all the copies made from this variogram
+     * \param nu the constant value of nu
      */
-    double operator()(const cd::vector& params, const double& x, const double& y) override;
+    MaternNuFixed(const double& nu) { set_nu(nu); };
+
+    /**
+     * \return the value of the variogram and store in grad its gradient, computed in closed form
+     */
+    double gradient(const double& x, const double& y, cd::vector& grad) const { return evaluate(x, y, grad); }
 }; // class MaternNuFixed
 
-class Gaussian : public VariogramFunction {
+class Gaussian : public VariogramFunction<Gaussian> {
 public:
     Gaussian() = default;
     /**
      * \return sigma * sigma * (1 - exp(-h*h))
-     * \param params a vector with lambda1, lambda2, phi and sigma in this exact order
      */
-    double operator()(const cd::vector& params, const double& x, const double& y) override;
+    double operator()(const double& x, const double& y) const
+    {
+        double h = compute_anisotropic_h(x, y);
+        return m_sigma * m_sigma * (1 - std::exp(-h * h));
+    }
+
+    /**
+     * \return the same value as above and store in grad its gradient, computed in closed form
+     */
+    double gradient(const double& x, const double& y, cd::vector& grad) const
+    {
+        Eigen::Vector3d dh;
+        double h = compute_anisotropic_h(x, y, dh);
+        double e = std::exp(-h * h);
+        grad.head<3>() = 2 * h * m_sigma * m_sigma * e * dh;
+        grad[3] = 2 * m_sigma * (1 - e);
+        return m_sigma * m_sigma * (1 - e);
+    }
 }; // class Gaussian
 
+/**
+ * \brief one of the variogram functions above. The fit and kriging use std::visit once to get the concrete type and
+ * their loops are instantiated for it
+ */
+using variogramfunction = std::variant<Exponential, Matern, MaternNuFixed, Gaussian>;
+
 /**
  * \brief allow to select between different functions for the variogram
  * \param id the name of chosen variogram
  */
-std::shared_ptr<VariogramFunction> make_variogramiso(const std::string& id);
+variogramfunction make_variogramiso(const std::string& id);
 } // namespace LocallyStationaryModels
 
 #endif // LOCALLY_STATIONARY_MODES_VARIOGRAM_FUNCTIONS
@@ -0,0 +1,123 @@
+// Copyright (C) Luca Crippa <luca7.crippa@mail.polimi.it>
+// Copyright (C) Giacomo De Carlo <giacomo.decarlo@mail.polimi.it>
+
+// Standalone benchmark of the construction of the kernel matrix, not part of the R package. Build it from the root of
+// the repository with:
+//     g++ -std=c++17 -O2 -fopenmp -I/path/to/eigen3 test/benchmark.cpp
+// and run it as ./a.out [number of points] [number of anchor points]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+// count the heap allocations made by Eigen: with EIGEN_RUNTIME_NO_MALLOC every allocation checks is_malloc_allowed()
+// through eigen_assert, which here counts the failures instead of aborting
+static std::atomic<size_t> n_allocations(0);
+#define EIGEN_RUNTIME_NO_MALLOC
+#define eigen_assert(x)                                                                                                \
+    do {                                                                                                               \
+        if (!(x))                                                                                                      \
+            n_allocations++;                                                                                           \
+    } while (false)
+
+#include "../src/kernel.cpp"
+#include "../src/spatialindex.cpp"
+#include "../src/kernelfunctions.cpp"
+
+using namespace LocallyStationaryModels;
+using namespace LocallyStationaryModels::cd;
+
+/**
+ * \brief the kernel matrix built as before the introduction of cd::vector2: the coordinates are passed as dynamic
+ * vectors, so every evaluation allocates the two arguments and their difference
+ */
+void build_kernel_dynamic(const matrix& data, const matrix& anchorpoints, const double& epsilon, matrix& k)
+{
+    std::function<double(const vector&, const vector&, const double&)> f
+        = [](const vector& x, const vector& y, const double& epsilon) {
+              return std::exp(-(x - y).squaredNorm() / (2 * epsilon * epsilon));
+          };
+    for (Eigen::Index i = 0; i < anchorpoints.rows(); ++i) {
+        for (Eigen::Index j = 0; j < data.rows(); ++j) {
+            k(i, j) = f(anchorpoints.row(i), data.row(j), epsilon);
+        }
+    }
+    for (Eigen::Index i = 0; i < anchorpoints.rows(); ++i) {
+        k.row(i) /= k.row(i).sum();
+    }
+}
+
+/**
+ * \brief the kernel matrix built with 2D vectors but calling the kernel function through a std::function, as before
+ * the kernel functions were dispatched statically
+ */
+void build_kernel_function(const matrix& data, const matrix& anchorpoints, const double& epsilon, matrix& k)
+{
+    std::function<double(const vector2&, const vector2&, const double&)> f = kf::Gaussian();
+    for (Eigen::Index i = 0; i < anchorpoints.rows(); ++i) {
+        vector2 anchor = anchorpoints.row(i);
+        for (Eigen::Index j = 0; j < data.rows(); ++j) {
+            vector2 point = data.row(j);
+            k(i, j) = f(anchor, point, epsilon);
+        }
+    }
+    for (Eigen::Index i = 0; i < anchorpoints.rows(); ++i) {
+        k.row(i) /= k.row(i).sum();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? std::atoi(argv[1]) : 20000;
+    size_t N = argc > 2 ? std::atoi(argv[2]) : 400;
+    double epsilon = 50;
+    omp_set_num_threads(1);
+
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<double> uniform(0, 1000);
+    matrixptr data = std::make_shared<matrix>(n, 2);
+    matrixptr anchorpoints = std::make_shared<matrix>(N, 2);
+    for (size_t i = 0; i < n; ++i) {
+        data->operator()(i, 0) = uniform(generator);
+        data->operator()(i, 1) = uniform(generator);
+    }
+    for (size_t i = 0; i < N; ++i) {
+        anchorpoints->operator()(i, 0) = uniform(generator);
+        anchorpoints->operator()(i, 1) = uniform(generator);
+    }
+
+    matrix reference(N, n);
+    Kernel kernel("gaussian", epsilon);
+    kernel.get_kernel()->resize(N, n);
+
+    Eigen::internal::set_is_malloc_allowed(false);
+    size_t allocations = n_allocations;
+    auto start = std::chrono::high_resolution_clock::now();
+    build_kernel_dynamic(*data, *anchorpoints, epsilon, reference);
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::printf("dynamic vectors: %8.1f ms, %zu allocations\n",
+        std::chrono::duration<double, std::milli>(stop - start).count(), n_allocations - allocations);
+
+    matrix function(N, n);
+    allocations = n_allocations;
+    start = std::chrono::high_resolution_clock::now();
+    build_kernel_function(*data, *anchorpoints, epsilon, function);
+    stop = std::chrono::high_resolution_clock::now();
+    std::printf("std::function:   %8.1f ms, %zu allocations\n",
+        std::chrono::duration<double, std::milli>(stop - start).count(), n_allocations - allocations);
+
+    allocations = n_allocations;
+    start = std::chrono::high_resolution_clock::now();
+    kernel.build_kernel(data, anchorpoints);
+    stop = std::chrono::high_resolution_clock::now();
+    std::printf("Kernel:          %8.1f ms, %zu allocations\n",
+        std::chrono::duration<double, std::milli>(stop - start).count(), n_allocations - allocations);
+    Eigen::internal::set_is_malloc_allowed(true);
+
+    std::printf("max difference:  %g\n",
+        std::max((reference - *(kernel.get_kernel())).cwiseAbs().maxCoeff(),
+            (reference - function).cwiseAbs().maxCoeff()));
+    return 0;
+}